@@ -37,82 +37,347 @@
 // #define USING_TESTBENCH          true    // Define when using HLS TestBench
 // #define LOAD_BALANCING_ENABLED   true    // Define to enable load balancing
 #define REDUCED_LUT_USAGE       true    // Define to reduce LUT usage
+// #define SPATIAL_GRID_ENABLED     true    // Define to bin the neighbour search
+// #define HALO_NBR_EXCHANGE        true    // Define to only send halo boids
+// #define SOA_NBR_SEARCH           true    // Define for host SIMD nbr search
+// #define NBR_LIST_CACHING         true    // Define to reuse neighbour lists
+#define NORMALISE_STRATEGY      NORMALISE_EXACT // Vector normalisation method
+// #define DOUBLE_BUFFERED_BOIDS    true    // Define to update into a 2nd buffer
+// #define BATCHED_BOID_TRANSFER    true    // Define to batch transferred boids
+// #define STREAMING_OUTPUT         true    // Define to write output directly
+// #define INCREMENTAL_NBR_SEARCH   true    // Define to search as boids arrive
+// #define PIPELINED_STEPS          true    // Define to merge the compute phases
+// #define ASYNC_TIME_STEPS         true    // Define to step without barriers
+// #define ACK_TREE                 true    // Define if the BoidMaster defines it
+
+#ifdef ASYNC_TIME_STEPS
+// A neighbour waits for every step-tagged message, so none can be dropped from 
+// a full output buffer
+#ifndef STREAMING_OUTPUT
+#error "ASYNC_TIME_STEPS requires STREAMING_OUTPUT"
+#endif
+
+// Every distinct neighbour is sent a transfer batch, possibly empty, so that it 
+// knows when the transfers of a time step are over
+#define BATCHED_BOID_TRANSFER   true
+
+// The most messages needed to send every boid of a BoidCPU, tagged with its 
+// time step
+#define MAX_STEP_MSGS           ((MAX_BOIDS / \
+        ((MAX_CMD_BODY_LEN - 2) / BOID_DATA_LENGTH)) + 1)
+
+// Enough for a full set of CMD_NBR_REPLY and CMD_BOID_BATCH messages from 
+// every neighbour
+#define MAX_DEFERRED_CMDS       (MAX_BOIDCPU_NEIGHBOURS * 2 * MAX_STEP_MSGS)
+#endif
+
+// The radius of the neighbour search, including any neighbour list skin
+#ifdef NBR_LIST_CACHING
+#define NBR_SEARCH_RADIUS           (VISION_RADIUS + NBR_LIST_SKIN)
+#else
+#define NBR_SEARCH_RADIUS           VISION_RADIUS
+#endif
+#define NBR_SEARCH_RADIUS_SQUARED   (NBR_SEARCH_RADIUS * NBR_SEARCH_RADIUS)
+
+#ifdef SOA_NBR_SEARCH
+// A host-only configuration, the SIMD kernels cannot be synthesised
+#include <stdint.h>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#endif
 
 /**************************** Function Prototypes *****************************/
 
+// The BoidCPU state that the functions operate on (see Struct Definitions)
+template<typename Capacity> struct BoidCPUState;
+typedef BoidCPUState<BOIDCPU_CAPACITY> BoidCPUContext;
+
 // Key function headers --------------------------------------------------------
-static void simulationSetup(void);
-static void calcNextBoidPositions(void);
+static void simulationSetup(BoidCPUContext &cpu);
+static void calcNextBoidPositions(BoidCPUContext &cpu);
 
 #ifdef LOAD_BALANCING_ENABLED
-static void evaluateLoad(void);
-static void loadBalance(void);
+static void evaluateLoad(BoidCPUContext &cpu);
+static void loadBalance(BoidCPUContext &cpu);
 #endif
 
-static void calculateEscapedBoids(void);
-static void updateDisplay(void);
+static void calculateEscapedBoids(BoidCPUContext &cpu);
+static BoidIndex findEscapedBoids(BoidCPUContext &cpu, BoidIndex *boidIndexes,
+        uint8 *recipientIDs);
+static void updateDisplay(BoidCPUContext &cpu);
+
+void wrapBoidPosition(BoidCPUContext &cpu, Boid *boid);
+#ifdef DOUBLE_BUFFERED_BOIDS
+void updateNextBoid(BoidCPUContext &cpu, int i);
+void swapBoidBuffers(BoidCPUContext &cpu);
+#ifdef HOST_RUNTIME
+void updateNextBoidsOnHost(BoidCPUContext &cpu);    // See host/boidCPUCore.cpp
+#endif
+#endif
 
-void calculateBoidNeighbours(void);
-void sendBoidsToNeighbours(void);
-void processNeighbouringBoids(void);
+void calculateBoidNeighbours(BoidCPUContext &cpu);
+void sendBoidsToNeighbours(BoidCPUContext &cpu);
+void processNeighbouringBoids(BoidCPUContext &cpu);
+void storeNeighbouringBoids(BoidCPUContext &cpu);
 
 // Supporting function headers -------------------------------------------------
-void transmitBoids(uint16 *boidIDs, uint8 *recipientIDs, uint8 count);
-void acceptBoid();
+void transmitBoids(BoidCPUContext &cpu, BoidIndex *boidIndexes,
+        uint8 *recipientIDs, BoidIndex count);
+void acceptBoid(BoidCPUContext &cpu);
+void queueBoid(BoidCPUContext &cpu, Boid boid);
+
+void packBoidsForSending(BoidCPUContext &cpu, uint32 to, uint32 msg_type);
+void packBoidsForSending(BoidCPUContext &cpu, uint32 to, uint32 msg_type,
+        BoidIndex *boidIndexes, BoidIndex count);
+Boid parsePackedBoid(BoidCPUContext &cpu, uint8 offset);
+
+void generateOutput(BoidCPUContext &cpu, uint32 len, uint32 to, uint32 type,
+        uint32 *data);
+bool fromNeighbour(BoidCPUContext &cpu);
+
+void commitAcceptedBoids(BoidCPUContext &cpu);
+void sendAck(BoidCPUContext &cpu, uint8 type);
+
+#ifdef ASYNC_TIME_STEPS
+void finishTimeStep(BoidCPUContext &cpu);
+void deferMessage(BoidCPUContext &cpu);
+#endif
 
-void packBoidsForSending(uint32 to, uint32 msg_type);
-Boid parsePackedBoid(uint8 offset);
+bool isBoidBeyond(BoidCPUContext &cpu, Boid boid, uint8 edge);
+bool isBoidBeyondSingle(BoidCPUContext &cpu, Boid boid, uint8 edge);
+#ifdef HALO_NBR_EXCHANGE
+bool isBoidInHalo(BoidCPUContext &cpu, Boid boid, uint8 edge);
+bool isBoidInHaloSingle(BoidCPUContext &cpu, Boid boid, uint8 edge);
+#endif
+bool isNeighbourTo(BoidCPUContext &cpu, uint16 bearing);
+
+#ifdef INCREMENTAL_NBR_SEARCH
+void findOwnBoidNeighbours(BoidCPUContext &cpu);
+void appendBoidNeighbours(BoidCPUContext &cpu, BoidIndex first);
+#endif
 
-void generateOutput(uint32 len, uint32 to, uint32 type, uint32 *data);
-bool fromNeighbour();
+#ifdef NBR_LIST_CACHING
+void cacheNeighbourLists(BoidCPUContext &cpu);
+void refreshNeighbourLists(BoidCPUContext &cpu);
+void checkNeighbourLists(BoidCPUContext &cpu);
+#endif
 
-void commitAcceptedBoids();
-void sendAck(uint8 type);
+#ifdef SOA_NBR_SEARCH
+void storeBoidsAsArrays(BoidCPUContext &cpu);
+void findNeighbourMask(BoidCPUContext &cpu, BoidIndex index, uint32_t *mask);
+#endif
 
-bool isBoidBeyond(Boid boid, uint8 edge);
-bool isBoidBeyondSingle(Boid boid, uint8 edge);
-bool isNeighbourTo(uint16 bearing);
+#ifdef SPATIAL_GRID_ENABLED
+void binPossibleNeighbours(BoidCPUContext &cpu);
+uint8 gridColumn(BoidCPUContext &cpu, int16_fp x);
+uint8 gridRow(BoidCPUContext &cpu, int16_fp y);
+#endif
 
 // Debugging function headers --------------------------------------------------
-void printCommand(bool send, uint32 *data);
-void printStateOfBoidCPUBoids();
+void printCommand(BoidCPUContext &cpu, bool send, uint32 *header,
+        uint32 *body);
+void printStateOfBoidCPUBoids(BoidCPUContext &cpu);
 
-/**************************** Variable Definitions ****************************/
+/***************************** Struct Definitions *****************************/
+
+/******************************************************************************/
+/*
+ * The state of a BoidCPU. Every state function operates on an instance of 
+ * this rather than on file-scope variables, so that more than one BoidCPU can 
+ * be hosted in a process. The array sizes are set by the capacity traits of 
+ * the BoidCPU (see BoidCPUCapacity in boidCPU.h). The HLS build keeps a single 
+ * static instance in toplevel().
+ *
+ ******************************************************************************/
+template<typename Capacity>
+struct BoidCPUState {
+    // BoidCPU variables -------------------------------------------------------
+    int8 boidCPUID;
+    int12 boidCPUCoords[4];
+
+    uint11 simulationWidth;
+    uint11 simulationHeight;
+
+    uint8 neighbouringBoidCPUs[MAX_BOIDCPU_NEIGHBOURS];
+    // True when neighbouring BoidCPUs have completed their setup
+    bool neighbouringBoidCPUsSetup;
+
+    // The number of distinct neighbouring BoidCPUs
+    uint8 distinctNeighbourCount;
+    uint8 distinctNeighbourCounter;     // A counter to the above
+
+    // Holds boids received from neighbouring BoidCPUs
+    Boid queuedBoids[Capacity::maxQueuedBoids];
+    BoidIndex queuedBoidsCounter;       // A counter for queued boids
+
+#ifdef PIPELINED_STEPS
+    // The boids found to have escaped by the position update, to be sent to 
+    // the recipient BoidCPUs in the transfer phase
+    BoidIndex escapedBoidIndexes[Capacity::maxBoids];
+    uint8 escapedRecipientIDs[Capacity::maxBoids];
+    BoidIndex escapedBoidCount;
+#endif
+
+#ifdef ASYNC_TIME_STEPS
+    // Asynchronous time step variables ----------------------------------------
+    uint32 timeStep;                    // The time step being simulated
+    uint8 transferCounter;              // Neighbours whose transfers are over
+    bool transfersSent;                 // True once own transfers are sent
+
+    // Neighbour replies for the next time step, held until it starts
+    uint32 deferredData[MAX_DEFERRED_CMDS][MAX_CMD_LEN];
+    uint16 deferredCount;
+#endif
 
-// BoidCPU variables -----------------------------------------------------------
-int8 boidCPUID = FIRST_BOIDCPU_ID;
-int12 boidCPUCoords[4];
+    uint32 inputData[MAX_CMD_LEN];
+#ifdef STREAMING_OUTPUT
+    // The output port, bound by toplevel(), that messages are written to
+    hls::stream<uint32> *outputStream;
+#else
+    uint32 outputData[Capacity::maxOutputCmds][MAX_CMD_LEN];
+    uint16 outputCount;                 // The number of output messages stored
+#endif
+    uint32 outputBody[30];
+
+    // Boid variables ----------------------------------------------------------
+    BoidIndex boidCount;
+#ifdef DOUBLE_BUFFERED_BOIDS
+    // The current and next boid state. The current buffer holds this BoidCPU's 
+    // boids followed by the boids received from neighbours, so that it doubles 
+    // as the list of possible neighbouring boids. Boids are updated into the 
+    // next buffer and the buffers are then swapped.
+    Boid boidBuffers[2][Capacity::maxNeighbouringBoids];
+    Boid *boids;
+    Boid *nextBoids;
+#else
+    // Boids leave by having the last boid moved into their slot, see 
+    // transmitBoids(), so the order of the boids is not preserved
+    Boid boids[Capacity::maxBoids];
+#endif
+    Boid *boidNeighbourList[Capacity::maxBoids][Capacity::maxBoidNeighbours];
 
-uint11 simulationWidth  = 0;
-uint11 simulationHeight = 0;
+    // A list of possible neighbouring boids for the BoidCPU
+#ifdef DOUBLE_BUFFERED_BOIDS
+    Boid *possibleBoidNeighbours;
+#else
+    Boid possibleBoidNeighbours[Capacity::maxNeighbouringBoids];
+#endif
+    BoidIndex possibleNeighbourCount;   // Number of possible boid neighbours
 
-uint8 neighbouringBoidCPUs[MAX_BOIDCPU_NEIGHBOURS];
-// True when neighbouring BoidCPUs have completed their setup
-bool neighbouringBoidCPUsSetup = false;
+#ifdef INCREMENTAL_NBR_SEARCH
+    // Incremental neighbour search variables ----------------------------------
+    // The number of neighbours found so far for each boid
+    uint8 boidNeighbourCount[Capacity::maxBoids];
+    bool ownNbrsFound;                  // True once own boids are searched
+#endif
 
-// The number of distinct neighbouring BoidCPUs
-uint8 distinctNeighbourCount = 0;
-uint8 distinctNeighbourCounter = 0;      // A counter to the above
+#ifdef NBR_LIST_CACHING
+    // Neighbour list caching variables ----------------------------------------
+    // The candidate neighbours of each boid (within NBR_SEARCH_RADIUS when the 
+    // lists were built), as indexes into possibleBoidNeighbours
+    BoidIndex candidateList[Capacity::maxBoids][Capacity::maxBoidNeighbours];
+    uint8 candidateCount[Capacity::maxBoids];
+    BoidIndex cachedNeighbourCount;     // possibleNeighbourCount at last build
+    BoidIndex cachedOwnBoidCount;       // boidCount at last build
+    Vector builtPositions[Capacity::maxBoids];  // Boid positions at last build
+    uint8 stepsSinceBuild;
+    uint8 nbrListRebuild;               // The NBR_REBUILD_* flags of the lists
+    bool keepNbrLists;                  // True if this search is skipped
+#endif
+
+#ifdef SOA_NBR_SEARCH
+    // Structure-of-arrays variables -------------------------------------------
+    // Copies of the boids and possible neighbouring boids as separate arrays 
+    // of raw int16_fp values (i.e. scaled by 2^SOA_FRACTIONAL_BITS) for the 
+    // SIMD neighbour search. Entries beyond the boid counts are padding.
+    int16_t boidX[MAX_SOA_BOIDS];
+    int16_t boidY[MAX_SOA_BOIDS];
+    int16_t boidID[MAX_SOA_BOIDS];
+
+    int16_t nbrX[MAX_SOA_BOIDS];
+    int16_t nbrY[MAX_SOA_BOIDS];
+    int16_t nbrID[MAX_SOA_BOIDS];
+#endif
 
-int16 queuedBoids[MAX_QUEUED_BOIDS][5];  // Holds boids received from neighbours
-uint8 queuedBoidsCounter = 0;            // A counter for queued boids
+#ifdef SPATIAL_GRID_ENABLED
+    // Spatial grid variables --------------------------------------------------
+    // The possible neighbouring boids binned into cells of GRID_CELL_SIZE 
+    // covering the BoidCPU's bounds and a halo around them. The boids in cell 
+    // c are the entries gridCellStart[c] to gridCellStart[c + 1] - 1 of 
+    // gridCellBoids.
+    uint8 gridColumns;
+    uint8 gridRows;
+    uint16 gridCellStart[MAX_GRID_CELLS + 1];
+    uint16 gridCellFill[MAX_GRID_CELLS];    // Insertion points when binning
+    BoidIndex gridCellBoids[Capacity::maxNeighbouringBoids];
+    uint16 gridCellOf[Capacity::maxNeighbouringBoids];
+#endif
 
-uint32 inputData[MAX_CMD_LEN];
-uint32 outputData[MAX_OUTPUT_CMDS][MAX_CMD_LEN];
-uint32 outputBody[30];
-uint8 outputCount = 0;                   // The number of output messages stored
+    // Debugging variables -----------------------------------------------------
+    bool continueOperation;
+
+    BoidCPUState() : boidCPUID(FIRST_BOIDCPU_ID), simulationWidth(0),
+            simulationHeight(0), neighbouringBoidCPUsSetup(false),
+            distinctNeighbourCount(0), distinctNeighbourCounter(0),
+            queuedBoidsCounter(0), boidCount(0), possibleNeighbourCount(0),
+            continueOperation(true) {
+#ifdef PIPELINED_STEPS
+        escapedBoidCount = 0;
+#endif
+#ifdef ASYNC_TIME_STEPS
+        timeStep = 0;
+        transferCounter = 0;
+        transfersSent = false;
+        deferredCount = 0;
+#endif
+#ifdef STREAMING_OUTPUT
+        outputStream = NULL;
+#else
+        outputCount = 0;
+#endif
+#ifdef DOUBLE_BUFFERED_BOIDS
+        boids = boidBuffers[0];
+        nextBoids = boidBuffers[1];
+        possibleBoidNeighbours = boidBuffers[0];
+#endif
+#ifdef INCREMENTAL_NBR_SEARCH
+        ownNbrsFound = false;
+#endif
+#ifdef NBR_LIST_CACHING
+        cachedNeighbourCount = 0;
+        cachedOwnBoidCount = 0;
+        stepsSinceBuild = 0;
+        nbrListRebuild = NBR_REBUILD_OWN;
+        keepNbrLists = false;
+#endif
+#ifdef SPATIAL_GRID_ENABLED
+        gridColumns = 0;
+        gridRows = 0;
+#endif
+    }
+};
 
-// Boid variables --------------------------------------------------------------
-uint8 boidCount;
-Boid boids[MAX_BOIDS];     // TODO: Perhaps re-implement as a LL due to deletion
-Boid *boidNeighbourList[MAX_BOIDS][MAX_NEIGHBOURING_BOIDS];
+/**************************** Variable Definitions ****************************/
 
-// A list of possible neighbouring boids for the BoidCPU
-Boid possibleBoidNeighbours[MAX_NEIGHBOURING_BOIDS];
-uint8 possibleNeighbourCount = 0;        // Number of possible boid neighbours
+// Reciprocal square roots of the centres of NORMALISE_LUT_SIZE equal intervals 
+// spanning [1, 2), used by Vector::normaliseLUT()
+const recip_fp invSqrtTable[NORMALISE_LUT_SIZE] = {
+        0.99227788, 0.97735555, 0.96308682, 0.94942533,
+        0.93632918, 0.92376043, 0.91168461, 0.90007032,
+        0.88888889, 0.87811408, 0.86772183, 0.85769003,
+        0.84799830, 0.83862787, 0.82956136, 0.82078268,
+        0.81227693, 0.80403025, 0.79602975, 0.78826342,
+        0.78072006, 0.77338919, 0.76626103, 0.75932640,
+        0.75257669, 0.74600385, 0.73960026, 0.73335880,
+        0.72727273, 0.72133571, 0.71554175, 0.70988521,
+};
 
-// Debugging variables ---------------------------------------------------------
-bool continueOperation = true;
+#ifdef USING_TESTBENCH
+// The number of boid updates where the fused flocking kernel did not match the 
+// three-pass implementation, reported by the test bench
+uint32 flockMismatchCount = 0;
+#endif
 
 /******************************************************************************/
 /*
@@ -137,65 +402,90 @@ void toplevel(hls::stream<uint32> &input, hls::stream<uint32> &output) {
 #pragma HLS RESOURCE variable = output core = AXI4Stream
 #pragma HLS INTERFACE ap_ctrl_none port = return
 
+#ifdef HOST_RUNTIME
+    // The host runtime (see host/) runs each BoidCPU on its own thread and 
+    // only calls this once per BoidCPU. The state of a large capacity BoidCPU 
+    // does not fit on a thread stack, so it is held on the heap.
+    BoidCPUContext *cpuInstance = new BoidCPUContext();
+    BoidCPUContext &cpu = *cpuInstance;
+#else
+    // The single instance of the BoidCPU state
+    static BoidCPUContext cpu;
+#endif
+
+#ifdef STREAMING_OUTPUT
+    cpu.outputStream = &output;
+#endif
+
     // Continually check for input and deal with it. Note that reading an empty
     // input stream will generate warnings in HLS, but should be blocking in the
     // actual implementation.
 
 #ifdef USING_TESTBENCH
-    inputData[CMD_LEN] = input.read();
+    cpu.inputData[CMD_LEN] = input.read();
 #endif
 
-    mainWhileLoop: while (continueOperation) {
+    mainWhileLoop: while (cpu.continueOperation) {
         // INPUT ---------------------------------------------------------------
         // Block until there is input available
 #ifndef USING_TESTBENCH
-        inputData[CMD_LEN] = input.read();
+        cpu.inputData[CMD_LEN] = input.read();
 #endif
 
         // When there is input, read in the command
-        inputLoop: for (int i = 1; i < inputData[CMD_LEN]; i++) {
-            inputData[i] = input.read();
+        inputLoop: for (int i = 1; i < cpu.inputData[CMD_LEN]; i++) {
+            cpu.inputData[i] = input.read();
         }
-        printCommand(false, inputData);
+        printCommand(cpu, false, cpu.inputData,
+                &cpu.inputData[CMD_HEADER_LEN]);
         // ---------------------------------------------------------------------
 
         // STATE CHANGE --------------------------------------------------------
-        if ((inputData[CMD_FROM] != boidCPUID) &&
-                ((inputData[CMD_TO] == boidCPUID) ||
-                        (inputData[CMD_TO] == CMD_BROADCAST) ||
-                        fromNeighbour())) {
-            switch (inputData[CMD_TYPE]) {
+        if ((cpu.inputData[CMD_FROM] != cpu.boidCPUID) &&
+                ((cpu.inputData[CMD_TO] == cpu.boidCPUID) ||
+                        (cpu.inputData[CMD_TO] == CMD_BROADCAST) ||
+                        fromNeighbour(cpu))) {
+            switch (cpu.inputData[CMD_TYPE]) {
             case CMD_SIM_SETUP:
-                simulationSetup();
+                simulationSetup(cpu);
                 break;
             case MODE_CALC_NBRS:
-                sendBoidsToNeighbours();
+                sendBoidsToNeighbours(cpu);
                 break;
             case CMD_NBR_REPLY:
-                processNeighbouringBoids();
+                processNeighbouringBoids(cpu);
                 break;
             case MODE_POS_BOIDS:
-                calcNextBoidPositions();
+                calcNextBoidPositions(cpu);
                 break;
 #ifdef LOAD_BALANCING_ENABLED
             case MODE_LOAD_BAL:
-                evaluateLoad();
+                evaluateLoad(cpu);
                 break;
             case CMD_LOAD_BAL:
-                loadBalance();
+                loadBalance(cpu);
                 break;
 #endif
             case MODE_TRAN_BOIDS:
-                calculateEscapedBoids();
+                calculateEscapedBoids(cpu);
                 break;
             case CMD_BOID:
-                acceptBoid();
+#ifdef BATCHED_BOID_TRANSFER
+            case CMD_BOID_BATCH:
+#endif
+                acceptBoid(cpu);
                 break;
             case MODE_DRAW:
-                updateDisplay();
+                updateDisplay(cpu);
                 break;
+#ifdef HOST_RUNTIME
+            case CMD_KILL:
+                // Stop the BoidCPU so that its host thread can be joined
+                cpu.continueOperation = false;
+                break;
+#endif
             default:
-                std::cout << "Command state " << inputData[CMD_TYPE] <<
+                std::cout << "Command state " << cpu.inputData[CMD_TYPE] <<
                 " not recognised" << std::endl;
                 break;
             }
@@ -204,24 +494,32 @@ void toplevel(hls::stream<uint32> &input, hls::stream<uint32> &output) {
         }
         // ---------------------------------------------------------------------
 
+#ifndef STREAMING_OUTPUT
         // OUTPUT --------------------------------------------------------------
         // If there is output to send, send it
-        if (outputCount > 0) {
-            outerOutLoop: for (int j = 0; j < outputCount; j++) {
-                innerOutLoop: for (int i = 0; i < outputData[j][CMD_LEN]; i++) {
-                    output.write(outputData[j][i]);
+        if (cpu.outputCount > 0) {
+            outerOutLoop: for (int j = 0; j < cpu.outputCount; j++) {
+                innerOutLoop: for (int i = 0; i < cpu.outputData[j][CMD_LEN];
+                        i++) {
+                    output.write(cpu.outputData[j][i]);
                 }
-                printCommand(true, outputData[j]);
+                printCommand(cpu, true, cpu.outputData[j],
+                        &cpu.outputData[j][CMD_HEADER_LEN]);
             }
         }
-        outputCount = 0;
+        cpu.outputCount = 0;
         // ---------------------------------------------------------------------
+#endif
 
 #ifdef USING_TESTBENCH
-        continueOperation = input.read_nb(inputData[0]);
+        cpu.continueOperation = input.read_nb(cpu.inputData[0]);
 #endif
     }
     std::cout << "=============BoidCPU has finished==============" << std::endl;
+
+#ifdef HOST_RUNTIME
+    delete cpuInstance;
+#endif
 }
 
 //==============================================================================
@@ -233,95 +531,123 @@ void toplevel(hls::stream<uint32> &input, hls::stream<uint32> &output) {
  * Sets ID to that provided by the controller. Populates list of neighbouring
  * BoidCPUs. Initialises pixel coordinates and edges. Creates own boids.
  *
- * @param   None
+ * @param   cpu     The BoidCPU state
  *
  * @return  None
  *
  ******************************************************************************/
-void simulationSetup() {
+void simulationSetup(BoidCPUContext &cpu) {
     std::cout << "-Preparing BoidCPU for simulation..." << std::endl;
 
     // Set BoidCPU parameters (supplied by the controller)
-    int8 oldBoidCPUID = boidCPUID;
-    boidCPUID = inputData[CMD_HEADER_LEN + CMD_SETUP_NEWID_IDX];
-    boidCount = inputData[CMD_HEADER_LEN + CMD_SETUP_BDCNT_IDX];
+    int8 oldBoidCPUID = cpu.boidCPUID;
+    cpu.boidCPUID = cpu.inputData[CMD_HEADER_LEN + CMD_SETUP_NEWID_IDX];
+    cpu.boidCount = cpu.inputData[CMD_HEADER_LEN + CMD_SETUP_BDCNT_IDX];
 
     edgeSetupLoop: for (int i = 0; i < EDGE_COUNT; i++) {
-        boidCPUCoords[i] = inputData[CMD_HEADER_LEN + CMD_SETUP_COORD_IDX + i];
+        cpu.boidCPUCoords[i] =
+                cpu.inputData[CMD_HEADER_LEN + CMD_SETUP_COORD_IDX + i];
     }
 
     // Get the number of distinct neighbours
-    distinctNeighbourCount = inputData[CMD_HEADER_LEN + CMD_SETUP_NBCNT_IDX];
+    cpu.distinctNeighbourCount =
+            cpu.inputData[CMD_HEADER_LEN + CMD_SETUP_NBCNT_IDX];
 
     // Get the list of neighbours on each edge
     neighbourSetupLoop: for (int i = 0; i < MAX_BOIDCPU_NEIGHBOURS; i++) {
-        neighbouringBoidCPUs[i] =
-                inputData[CMD_HEADER_LEN + CMD_SETUP_BNBRS_IDX + i];
+        cpu.neighbouringBoidCPUs[i] =
+                cpu.inputData[CMD_HEADER_LEN + CMD_SETUP_BNBRS_IDX + i];
     }
-    neighbouringBoidCPUsSetup = true;
+    cpu.neighbouringBoidCPUsSetup = true;
 
     // Get the simulation width and height
-    simulationWidth  = inputData[CMD_HEADER_LEN + CMD_SETUP_SIMWH_IDX];
-    simulationHeight = inputData[CMD_HEADER_LEN + CMD_SETUP_SIMWH_IDX + 1];
+    cpu.simulationWidth  = cpu.inputData[CMD_HEADER_LEN + CMD_SETUP_SIMWH_IDX];
+    cpu.simulationHeight =
+            cpu.inputData[CMD_HEADER_LEN + CMD_SETUP_SIMWH_IDX + 1];
 
     // Print out BoidCPU parameters
     std::cout << "BoidCPU #" << oldBoidCPUID << " now has ID #" <<
-            boidCPUID << std::endl;
-    std::cout << "BoidCPU #" << boidCPUID << " initial boid count: " <<
-            boidCount << std::endl;
-    std::cout << "BoidCPU #" << boidCPUID << " has " << distinctNeighbourCount
+            cpu.boidCPUID << std::endl;
+    std::cout << "BoidCPU #" << cpu.boidCPUID << " initial boid count: " <<
+            cpu.boidCount << std::endl;
+    std::cout << "BoidCPU #" << cpu.boidCPUID << " has " << cpu.distinctNeighbourCount
             << " distinct neighbouring BoidCPUs" << std::endl;
 
-    std::cout << "BoidCPU #" << boidCPUID << " coordinates: [";
+    std::cout << "BoidCPU #" << cpu.boidCPUID << " coordinates: [";
     printEdgeLoop: for (int i = 0; i < EDGE_COUNT; i++) {
-        std::cout << boidCPUCoords[i] << ", ";
+        std::cout << cpu.boidCPUCoords[i] << ", ";
     } std::cout << "]" << std::endl;
-    std::cout << "BoidCPU #" << boidCPUID << " neighbours: [";
+    std::cout << "BoidCPU #" << cpu.boidCPUID << " neighbours: [";
     printNeighbourLoop: for (int i = 0; i < MAX_BOIDCPU_NEIGHBOURS; i++) {
-        std::cout << neighbouringBoidCPUs[i] << ", ";
+        std::cout << cpu.neighbouringBoidCPUs[i] << ", ";
     } std::cout << "]" << std::endl;
 
-    std::cout << "The simulation is of width " << simulationWidth <<
-            " and of height " << simulationHeight << std::endl;
+    std::cout << "The simulation is of width " << cpu.simulationWidth <<
+            " and of height " << cpu.simulationHeight << std::endl;
 
     // Create the boids
     uint16 boidID;
-    int12 widthStep  = (boidCPUCoords[2] - boidCPUCoords[0]) / boidCount;
-    int12 heightStep = (boidCPUCoords[3] - boidCPUCoords[1]) / boidCount;
+    int12 widthStep  = (cpu.boidCPUCoords[2] - cpu.boidCPUCoords[0]) /
+            cpu.boidCount;
+    int12 heightStep = (cpu.boidCPUCoords[3] - cpu.boidCPUCoords[1]) /
+            cpu.boidCount;
+
+    // The boids are spread along the diagonal of the BoidCPU. If there are 
+    // more boids than pixels along it (only possible with a large capacity) 
+    // they are instead spread over a square lattice.
+    uint16 latticeSide = 1;
+    if ((widthStep == 0) || (heightStep == 0)) {
+        latticeSideLoop: while ((latticeSide * latticeSide) < cpu.boidCount) {
+            latticeSide++;
+        }
+
+        widthStep  = (cpu.boidCPUCoords[2] - cpu.boidCPUCoords[0]) /
+                latticeSide;
+        heightStep = (cpu.boidCPUCoords[3] - cpu.boidCPUCoords[1]) /
+                latticeSide;
+    }
 
 #ifdef REDUCED_LUT_USAGE
     // FIXME: Only works for BoidCPUs less than MAX_VELOCITY * 2
-    int4 initialSpeed = -MAX_VELOCITY + boidCPUID;
+    int4 initialSpeed = -MAX_VELOCITY + cpu.boidCPUID;
 #else
     // This could be used to add some variance to the velocities of the boids
-    int16_fp velStep = int16_fp(MAX_VELOCITY + MAX_VELOCITY) / boidCount;
+    int16_fp velStep = int16_fp(MAX_VELOCITY + MAX_VELOCITY) / cpu.boidCount;
 #endif
 
-    boidCreationLoop: for (int i = 0; i < boidCount; i++) {
+    boidCreationLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        uint16 column = i;
+        uint16 row = i;
+        if (latticeSide > 1) {
+            column = i % latticeSide;
+            row = i / latticeSide;
+        }
+
 #ifdef REDUCED_LUT_USAGE
         Vector velocity = Vector(initialSpeed, -initialSpeed);
 
-        Vector position = Vector((widthStep * i) + boidCPUCoords[0] + 1,
-                (heightStep * i) + boidCPUCoords[1] + 1);
+        Vector position = Vector((widthStep * column) + cpu.boidCPUCoords[0] + 1,
+                (heightStep * row) + cpu.boidCPUCoords[1] + 1);
 #else
-        Vector velocity = Vector(-MAX_VELOCITY + (velStep * i) + boidCPUID,
+        Vector velocity = Vector(-MAX_VELOCITY + (velStep * i) + cpu.boidCPUID,
                 MAX_VELOCITY - (velStep * i));
 
         // This would introduce some variance into the positions of the boids
-        int16_fp xPos = (widthStep * i) + boidCPUCoords[0] + 1;
-        if (int4(xPos) < 0) xPos = xPos + boidCPUID + boidCPUID + boidCPUID;
+        int16_fp xPos = (widthStep * column) + cpu.boidCPUCoords[0] + 1;
+        if (int4(xPos) < 0) xPos = xPos + cpu.boidCPUID + cpu.boidCPUID + cpu.boidCPUID;
 
-        Vector position = Vector(xPos, (heightStep * i) + boidCPUCoords[1] + 1);
+        Vector position = Vector(xPos,
+                (heightStep * row) + cpu.boidCPUCoords[1] + 1);
 #endif
 
-        boidID = ((boidCPUID - 1) * boidCount) + i + 1;
+        boidID = ((cpu.boidCPUID - 1) * cpu.boidCount) + i + 1;
 
         Boid boid = Boid(boidID, position, velocity);
-        boids[i] = boid;
+        cpu.boids[i] = boid;
     }
 
     // Send ACK signal
-    sendAck(CMD_SIM_SETUP);
+    sendAck(cpu, CMD_SIM_SETUP);
 }
 
 /******************************************************************************/
@@ -330,30 +656,109 @@ void simulationSetup() {
  * in calculating neighbours for their boids. Splits the data to be sent into
  * multiple messages if it exceeds the maximum command data size.
  *
- * @param   None
+ * If HALO_NBR_EXCHANGE is defined, each distinct neighbour is instead sent a 
+ * direct message containing only the boids that lie within NBR_SEARCH_RADIUS 
+ * of the edges or corners it shares with this BoidCPU. The boids of a neighbour 
+ * cannot see any other boids, so its neighbour search is unchanged. Every 
+ * distinct neighbour is still sent at least one (possibly empty) message so 
+ * that it knows when this BoidCPU has finished sending. Note that with up to 
+ * 8 distinct neighbours, this uses more of the output buffer than multicast.
+ *
+ * If INCREMENTAL_NBR_SEARCH is defined, the boids of this BoidCPU are searched 
+ * for neighbours amongst themselves once they have been sent, while the 
+ * replies of the neighbouring BoidCPUs are still on their way.
+ *
+ * If NBR_LIST_CACHING is defined, a BoidCPU whose own lists are still valid 
+ * keeps them, unless the MODE_CALC_NBRS message says that every list must be 
+ * rebuilt. It still sends its boids, as a neighbour may be rebuilding, but 
+ * ignores the replies and skips the search.
+ *
+ * @param   cpu     The BoidCPU state
  *
  * @return  None
  *
  ******************************************************************************/
-void sendBoidsToNeighbours() {
+void sendBoidsToNeighbours(BoidCPUContext &cpu) {
     std::cout << "-Sending boids to neighbouring BoidCPUs..." << std::endl;
 
-    packBoidsForSending(CMD_MULTICAST, CMD_NBR_REPLY);
+#ifdef NBR_LIST_CACHING
+    cpu.keepNbrLists = (cpu.nbrListRebuild == 0) &&
+            (cpu.inputData[CMD_TYPE] == MODE_CALC_NBRS) &&
+            (cpu.inputData[CMD_LEN] > CMD_HEADER_LEN + CMD_CALC_RBLD_IDX) &&
+            !(cpu.inputData[CMD_HEADER_LEN + CMD_CALC_RBLD_IDX] &
+                    NBR_REBUILD_ALL);
+#endif
+
+#ifdef HALO_NBR_EXCHANGE
+    BoidIndex haloBoids[MAX_BOIDS];
+
+    haloNbrLoop: for (int bearing = NORTHWEST; bearing < WEST + 1; bearing++) {
+        uint8 neighbour = cpu.neighbouringBoidCPUs[bearing];
+
+        // Only send once to each distinct neighbour, and never to self
+        bool alreadySent = (!isNeighbourTo(cpu, bearing)) ||
+                (neighbour == cpu.boidCPUID);
+        haloSentLoop: for (int b = NORTHWEST; b < bearing; b++) {
+            if (cpu.neighbouringBoidCPUs[b] == neighbour) {
+                alreadySent = true;
+            }
+        }
+
+        if (!alreadySent) {
+            // Select the boids in the halo of any edge shared with the neighbour
+            BoidIndex haloCount = 0;
+            haloBoidLoop: for (int i = 0; i < cpu.boidCount; i++) {
+                haloBearLoop: for (int b = bearing; b < WEST + 1; b++) {
+                    if ((cpu.neighbouringBoidCPUs[b] == neighbour) &&
+                            isBoidInHalo(cpu, cpu.boids[i], b)) {
+                        haloBoids[haloCount] = i;
+                        haloCount++;
+                        break;
+                    }
+                }
+            }
+
+            packBoidsForSending(cpu, neighbour, CMD_NBR_REPLY, haloBoids,
+                    haloCount);
+        }
+    }
+#else
+    packBoidsForSending(cpu, CMD_MULTICAST, CMD_NBR_REPLY);
+#endif
+
+#if defined(INCREMENTAL_NBR_SEARCH) && defined(NBR_LIST_CACHING)
+    if (!cpu.keepNbrLists) {
+        findOwnBoidNeighbours(cpu);
+    }
+#elif defined(INCREMENTAL_NBR_SEARCH)
+    findOwnBoidNeighbours(cpu);
+#endif
 
 #ifndef REDUCED_LUT_USAGE
     // If there is just one BoidCPU - should not happen (often) if LUT usage
     // is reduced as at least 2 BoidCPUs can fit on a single Atlys board
     // This is quite a costly operation.
-    if (distinctNeighbourCount == 0) {
-        addOwnBoidsToNbrListZero: for (int i = 0; i < boidCount; i++) {
-            possibleBoidNeighbours[possibleNeighbourCount] = boids[i];
-            possibleNeighbourCount++;
+    if (cpu.distinctNeighbourCount == 0) {
+#if defined(INCREMENTAL_NBR_SEARCH)
+        // The own boids have already been searched above
+#elif defined(DOUBLE_BUFFERED_BOIDS)
+        cpu.possibleNeighbourCount = cpu.boidCount;
+#else
+        addOwnBoidsToNbrListZero: for (int i = 0; i < cpu.boidCount; i++) {
+            cpu.possibleBoidNeighbours[cpu.possibleNeighbourCount] = cpu.boids[i];
+            cpu.possibleNeighbourCount++;
         }
+#endif
 
-        calculateBoidNeighbours();
+        calculateBoidNeighbours(cpu);
 
+#if defined(PIPELINED_STEPS) || defined(ASYNC_TIME_STEPS)
+        // Go straight on to the position update
+        calcNextBoidPositions(cpu);
+#else
         // Send ACK signal
-        sendAck(MODE_CALC_NBRS);
+        sendAck(cpu, MODE_CALC_NBRS);
+#endif
     }
 #endif
 }
@@ -362,55 +767,122 @@ void sendBoidsToNeighbours() {
 /*
  * When boids are received from neighbouring BoidCPUs, process them and add
  * them to a list of possible neighbouring boids. These are used to calculate
- * the neighbours of boids contained within this BoidCPU.
+ * the neighbours of boids contained within this BoidCPU. The messages may 
+ * contain all of a neighbour's boids (multicast) or only those in its halo 
+ * (HALO_NBR_EXCHANGE), the number of boids is taken from the message length.
  *
- * @param   None
+ * If INCREMENTAL_NBR_SEARCH is defined, the received boids are tested against 
+ * the boids of this BoidCPU as soon as they arrive, rather than all at once 
+ * after the last message. Only the neighbour details are then left to set.
+ *
+ * If PIPELINED_STEPS is defined, the positions of the boids are updated as 
+ * soon as their neighbours are known, without waiting for the BoidMaster to 
+ * start the MODE_POS_BOIDS phase. The ACK is sent after the update.
+ *
+ * If ASYNC_TIME_STEPS is defined, each message is tagged with the time step 
+ * of its sender. A neighbour that has already finished the current time step 
+ * may send its boids for the next one, so these are deferred until this 
+ * BoidCPU starts that time step (see finishTimeStep()). The positions are 
+ * then updated as above.
+ *
+ * @param   cpu     The BoidCPU state
  *
  * @return  None
  *
  ******************************************************************************/
-void processNeighbouringBoids() {
-    // Before processing first response, add own boids to list
-    if (distinctNeighbourCounter == 0) {
-        addOwnBoidsToNbrList: for (int i = 0; i < boidCount; i++) {
-            possibleBoidNeighbours[possibleNeighbourCount] = boids[i];
-            possibleNeighbourCount++;
+void processNeighbouringBoids(BoidCPUContext &cpu) {
+#ifdef ASYNC_TIME_STEPS
+    if (cpu.inputData[cpu.inputData[CMD_LEN] - 1] != cpu.timeStep) {
+        deferMessage(cpu);
+        return;
+    }
+#endif
+
+#ifdef NBR_LIST_CACHING
+    // The boids are only needed if the lists are being rebuilt
+    if (!cpu.keepNbrLists) {
+        storeNeighbouringBoids(cpu);
+    }
+#else
+    storeNeighbouringBoids(cpu);
+#endif
+
+    // If no further messages are expected, then process it
+    if (cpu.inputData[CMD_HEADER_LEN + 0] == 0) {
+        cpu.distinctNeighbourCounter++;
+
+        if (cpu.distinctNeighbourCounter == cpu.distinctNeighbourCount) {
+            calculateBoidNeighbours(cpu);
+
+#if defined(PIPELINED_STEPS) || defined(ASYNC_TIME_STEPS)
+            // Go straight on to the position update
+            calcNextBoidPositions(cpu);
+#else
+            // Send ACK signal
+            sendAck(cpu, MODE_CALC_NBRS);
+#endif
         }
+    } else {
+        std::cout << "Expecting " << cpu.inputData[CMD_HEADER_LEN + 0] << \
+                " further message(s) from " << cpu.inputData[CMD_FROM] << std::endl;
     }
+}
+
+/******************************************************************************/
+/*
+ * Adds the boids of a CMD_NBR_REPLY message to the list of possible 
+ * neighbouring boids, along with this BoidCPU's own boids before the first.
+ *
+ * @param   cpu     The BoidCPU state
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void storeNeighbouringBoids(BoidCPUContext &cpu) {
+#ifdef INCREMENTAL_NBR_SEARCH
+    // A reply may arrive before this BoidCPU has sent its own boids
+    findOwnBoidNeighbours(cpu);
+
+    BoidIndex firstReceived = cpu.possibleNeighbourCount;
+#else
+    // Before processing first response, add own boids to list. When double 
+    // buffered, they are already at the start of the list. The first response 
+    // may span several messages, so only do this once.
+    if ((cpu.distinctNeighbourCounter == 0) &&
+            (cpu.possibleNeighbourCount == 0)) {
+#ifdef DOUBLE_BUFFERED_BOIDS
+        cpu.possibleNeighbourCount = cpu.boidCount;
+#else
+        addOwnBoidsToNbrList: for (int i = 0; i < cpu.boidCount; i++) {
+            cpu.possibleBoidNeighbours[cpu.possibleNeighbourCount] = cpu.boids[i];
+            cpu.possibleNeighbourCount++;
+        }
+#endif
+    }
+#endif
 
     // Calculate the number of boids per message TODO: Remove division
-    uint8 boidsPerMsg = (inputData[CMD_LEN] - CMD_HEADER_LEN - 1) /
+    uint8 boidsPerMsg = (cpu.inputData[CMD_LEN] - CMD_HEADER_LEN - 1) /
             BOID_DATA_LENGTH;
 
-    std::cout << "-BoidCPU #" << boidCPUID << " received " << boidsPerMsg <<
-            " boids from BoidCPU #" << inputData[CMD_FROM] << std::endl;
+    std::cout << "-BoidCPU #" << cpu.boidCPUID << " received " << boidsPerMsg <<
+            " boids from BoidCPU #" << cpu.inputData[CMD_FROM] << std::endl;
 
     // Parse each received boid and add to possible neighbour list
     rxNbrBoidLoop: for (int i = 0; i < boidsPerMsg; i++) {
-        possibleBoidNeighbours[possibleNeighbourCount] = parsePackedBoid(i);
-
         // Don't go beyond the edge of the array
-        if (possibleNeighbourCount != MAX_NEIGHBOURING_BOIDS) {
-            possibleNeighbourCount++;
+        if (cpu.possibleNeighbourCount != MAX_NEIGHBOURING_BOIDS) {
+            cpu.possibleBoidNeighbours[cpu.possibleNeighbourCount] =
+                    parsePackedBoid(cpu, i);
+            cpu.possibleNeighbourCount++;
         } else {
             break;
         }
     }
 
-    // If no further messages are expected, then process it
-    if (inputData[CMD_HEADER_LEN + 0] == 0) {
-        distinctNeighbourCounter++;
-
-        if (distinctNeighbourCounter == distinctNeighbourCount) {
-            calculateBoidNeighbours();
-
-            // Send ACK signal
-            sendAck(MODE_CALC_NBRS);
-        }
-    } else {
-        std::cout << "Expecting " << inputData[CMD_HEADER_LEN + 0] << \
-                " further message(s) from " << inputData[CMD_FROM] << std::endl;
-    }
+#ifdef INCREMENTAL_NBR_SEARCH
+    appendBoidNeighbours(cpu, firstReceived);
+#endif
 }
 
 /******************************************************************************/
@@ -420,35 +892,652 @@ void processNeighbouringBoids() {
  * complex to determine when all the boids from neighbours had been received
  * due to splitting of data over multiple messages and replicated neighbours.
  *
- * @param   None
+ * If SPATIAL_GRID_ENABLED is defined, the possible neighbours are first binned
+ * into a grid of NBR_SEARCH_RADIUS-sized cells and each boid only tests the 3x3
+ * cells around its own. Any boid within the radius must lie in one of these
+ * cells, and the neighbours are kept in the order of possibleBoidNeighbours,
+ * so the resulting neighbour lists are identical to the brute-force search.
+ *
+ * If SOA_NBR_SEARCH is defined (host builds only), the boids are copied into 
+ * separate x/y/id arrays and a SIMD kernel produces a bitmask of the 
+ * neighbours of each boid. This takes precedence over SPATIAL_GRID_ENABLED. 
+ * The kernel is exact, so the neighbour lists are again identical.
+ *
+ * If NBR_LIST_CACHING is defined, the search uses a radius of VISION_RADIUS + 
+ * NBR_LIST_SKIN and the resulting lists are cached as candidate lists. These 
+ * are filtered down to VISION_RADIUS on each position update and reused until 
+ * a rebuild is needed, see checkNeighbourLists(). The search is skipped while 
+ * the cached lists are kept, see sendBoidsToNeighbours().
+ *
+ * If INCREMENTAL_NBR_SEARCH is defined, the lists have already been built as 
+ * the boids arrived (see appendBoidNeighbours()) and are only handed to the 
+ * boids here. This takes precedence over the other search methods.
+ *
+ * Each boid keeps at most MAX_BOID_NEIGHBOURS neighbours, the first ones in 
+ * possibleBoidNeighbours order. For the FPGA capacity this is no limit at all.
+ *
+ * @param   cpu     The BoidCPU state
  *
  * @return  None
  *
  ******************************************************************************/
-void calculateBoidNeighbours() {
-    outerCalcBoidNbrsLoop: for (int i = 0; i < boidCount; i++) {
+void calculateBoidNeighbours(BoidCPUContext &cpu) {
+#ifdef NBR_LIST_CACHING
+    if (cpu.keepNbrLists) {
+        std::cout << "-Keeping the cached neighbour lists" << std::endl;
+
+        // Reset the flags, the cached lists are still valid
+        cpu.possibleNeighbourCount = 0;
+        cpu.distinctNeighbourCounter = 0;
+#ifdef INCREMENTAL_NBR_SEARCH
+        cpu.ownNbrsFound = false;
+#endif
+        return;
+    }
+#endif
+
+#if defined(INCREMENTAL_NBR_SEARCH)
+    incNbrDetailsLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        cpu.boids[i].setNeighbourDetails(cpu.boidNeighbourList[i],
+                cpu.boidNeighbourCount[i]);
+    }
+#elif defined(SOA_NBR_SEARCH)
+    uint32_t neighbourMask[SOA_MASK_WORDS];
+
+    storeBoidsAsArrays(cpu);
+
+    outerSoABoidNbrsLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        uint8 boidNeighbourCount = 0;
+
+        findNeighbourMask(cpu, i, neighbourMask);
+
+        // Visit the set bits in order to match the brute-force search
+        soaMaskLoop: for (int w = 0; w < SOA_MASK_WORDS; w++) {
+            uint32_t bits = neighbourMask[w];
+
+            soaBitLoop: while (bits != 0) {
+                int j = (w * 32) + __builtin_ctz(bits);
+                bits &= bits - 1;
+
+                if (boidNeighbourCount < MAX_BOID_NEIGHBOURS) {
+                    cpu.boidNeighbourList[i][boidNeighbourCount] =
+                            &cpu.possibleBoidNeighbours[j];
+                    boidNeighbourCount++;
+                }
+            }
+        }
+
+        cpu.boids[i].setNeighbourDetails(cpu.boidNeighbourList[i],
+                boidNeighbourCount);
+    }
+#elif defined(SPATIAL_GRID_ENABLED)
+    BoidIndex neighbourIndexes[MAX_BOID_NEIGHBOURS];
+
+    binPossibleNeighbours(cpu);
+
+    outerGridBoidNbrsLoop: for (int i = 0; i < cpu.boidCount; i++) {
         uint8 boidNeighbourCount = 0;
-        inCalcBoidNbrsLoop: for (int j = 0; j < possibleNeighbourCount; j++) {
-            if (possibleBoidNeighbours[j].id != boids[i].id) {
+        uint8 column = gridColumn(cpu, cpu.boids[i].position.x);
+        uint8 row = gridRow(cpu, cpu.boids[i].position.y);
+
+        uint8 firstRow = (row == 0) ? row : (uint8)(row - 1);
+        uint8 lastRow = (row == cpu.gridRows - 1) ? row : (uint8)(row + 1);
+        uint8 firstColumn = (column == 0) ? column : (uint8)(column - 1);
+        uint8 lastColumn = (column == cpu.gridColumns - 1) ? column : (uint8)(column + 1);
+
+        gridRowLoop: for (uint8 r = firstRow; r <= lastRow; r++) {
+            gridColumnLoop: for (uint8 c = firstColumn; c <= lastColumn; c++) {
+                uint16 cell = (r * cpu.gridColumns) + c;
+
+                gridCellLoop: for (uint16 k = cpu.gridCellStart[cell];
+                        k < cpu.gridCellStart[cell + 1]; k++) {
+                    BoidIndex j = cpu.gridCellBoids[k];
+
+                    if (cpu.possibleBoidNeighbours[j].id != cpu.boids[i].id) {
+                        int32_fp boidSeparation = Vector::squaredDistanceBetween(
+                                cpu.boids[i].position,
+                                cpu.possibleBoidNeighbours[j].position);
+
+                        // Once the list is full, only a lower index displaces 
+                        // the last neighbour, as in the brute-force search
+                        bool listFull =
+                                (boidNeighbourCount == MAX_BOID_NEIGHBOURS);
+                        bool listRoom = !listFull ||
+                                (j < neighbourIndexes[MAX_BOID_NEIGHBOURS - 1]);
+
+                        if ((boidSeparation < NBR_SEARCH_RADIUS_SQUARED) &&
+                                listRoom) {
+                            // Insert in possibleBoidNeighbours order to match
+                            // the brute-force search
+                            uint8 n = listFull ? (uint8)(boidNeighbourCount - 1)
+                                    : boidNeighbourCount;
+                            gridSortLoop: while ((n > 0) &&
+                                    (neighbourIndexes[n - 1] > j)) {
+                                neighbourIndexes[n] = neighbourIndexes[n - 1];
+                                n--;
+                            }
+                            neighbourIndexes[n] = j;
+
+                            if (!listFull) {
+                                boidNeighbourCount++;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        gridNbrListLoop: for (int n = 0; n < boidNeighbourCount; n++) {
+            cpu.boidNeighbourList[i][n] =
+                    &cpu.possibleBoidNeighbours[neighbourIndexes[n]];
+        }
+
+        cpu.boids[i].setNeighbourDetails(cpu.boidNeighbourList[i],
+                boidNeighbourCount);
+    }
+#else
+    outerCalcBoidNbrsLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        uint8 boidNeighbourCount = 0;
+        inCalcBoidNbrsLoop: for (int j = 0; j < cpu.possibleNeighbourCount; j++) {
+            if (cpu.possibleBoidNeighbours[j].id != cpu.boids[i].id) {
                 int32_fp boidSeparation = Vector::squaredDistanceBetween(
-                        boids[i].position, possibleBoidNeighbours[j].position);
+                        cpu.boids[i].position, cpu.possibleBoidNeighbours[j].position);
 
-                if (boidSeparation < VISION_RADIUS_SQUARED) {
-                    boidNeighbourList[i][boidNeighbourCount] =
-                            &possibleBoidNeighbours[j];
+                if ((boidSeparation < NBR_SEARCH_RADIUS_SQUARED) &&
+                        (boidNeighbourCount < MAX_BOID_NEIGHBOURS)) {
+                    cpu.boidNeighbourList[i][boidNeighbourCount] =
+                            &cpu.possibleBoidNeighbours[j];
                     boidNeighbourCount++;
                 }
             }
         }
 
-        boids[i].setNeighbourDetails(i, boidNeighbourCount);
+        cpu.boids[i].setNeighbourDetails(cpu.boidNeighbourList[i],
+                boidNeighbourCount);
     }
+#endif
+
+#ifdef NBR_LIST_CACHING
+    cacheNeighbourLists(cpu);
+#endif
 
     // Reset the flags
-    possibleNeighbourCount = 0;
-    distinctNeighbourCounter = 0;
+    cpu.possibleNeighbourCount = 0;
+    cpu.distinctNeighbourCounter = 0;
+#ifdef INCREMENTAL_NBR_SEARCH
+    cpu.ownNbrsFound = false;
+#endif
+}
+
+#ifdef INCREMENTAL_NBR_SEARCH
+/******************************************************************************/
+/*
+ * Adds the boids of this BoidCPU to the start of the list of possible 
+ * neighbouring boids and searches them for neighbours amongst themselves. 
+ * This only happens once per neighbour search, so it can be called both when 
+ * the boids are sent to neighbours and when the first reply arrives.
+ *
+ * @param   cpu     The BoidCPU state
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void findOwnBoidNeighbours(BoidCPUContext &cpu) {
+    if (!cpu.ownNbrsFound) {
+#ifdef DOUBLE_BUFFERED_BOIDS
+        cpu.possibleNeighbourCount = cpu.boidCount;
+#else
+        addOwnBoidsToIncList: for (int i = 0; i < cpu.boidCount; i++) {
+            cpu.possibleBoidNeighbours[i] = cpu.boids[i];
+        }
+        cpu.possibleNeighbourCount = cpu.boidCount;
+#endif
+
+        resetNbrCountLoop: for (int i = 0; i < cpu.boidCount; i++) {
+            cpu.boidNeighbourCount[i] = 0;
+        }
+
+        appendBoidNeighbours(cpu, 0);
+        cpu.ownNbrsFound = true;
+    }
+}
+
+/******************************************************************************/
+/*
+ * Tests the possible neighbouring boids from the given index onwards against 
+ * each boid of this BoidCPU and appends any within NBR_SEARCH_RADIUS to the 
+ * neighbour list of that boid. As the boids are tested in the order that they 
+ * were added, the lists are the same as those of the brute-force search.
+ *
+ * @param   cpu     The BoidCPU state
+ * @param   first   The index of the first possible neighbour to test
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void appendBoidNeighbours(BoidCPUContext &cpu, BoidIndex first) {
+    outerIncBoidNbrsLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        uint8 boidNeighbourCount = cpu.boidNeighbourCount[i];
+
+        inIncBoidNbrsLoop: for (int j = first; j < cpu.possibleNeighbourCount;
+                j++) {
+            if (cpu.possibleBoidNeighbours[j].id != cpu.boids[i].id) {
+                int32_fp boidSeparation = Vector::squaredDistanceBetween(
+                        cpu.boids[i].position, cpu.possibleBoidNeighbours[j].position);
+
+                if ((boidSeparation < NBR_SEARCH_RADIUS_SQUARED) &&
+                        (boidNeighbourCount < MAX_BOID_NEIGHBOURS)) {
+                    cpu.boidNeighbourList[i][boidNeighbourCount] =
+                            &cpu.possibleBoidNeighbours[j];
+                    boidNeighbourCount++;
+                }
+            }
+        }
+
+        cpu.boidNeighbourCount[i] = boidNeighbourCount;
+    }
+}
+#endif
+
+#ifdef NBR_LIST_CACHING
+/******************************************************************************/
+/*
+ * Stores the neighbour lists just built as candidate lists, along with the 
+ * current boid positions, so that they can be reused on later time steps.
+ *
+ * @param   cpu     The BoidCPU state
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void cacheNeighbourLists(BoidCPUContext &cpu) {
+    cacheBoidLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        uint8 count = cpu.boids[i].getNeighbourCount();
+
+        cacheNbrLoop: for (int n = 0; n < count; n++) {
+            cpu.candidateList[i][n] = cpu.boidNeighbourList[i][n] -
+                    cpu.possibleBoidNeighbours;
+        }
+
+        cpu.candidateCount[i] = count;
+        cpu.builtPositions[i] = cpu.boids[i].position;
+    }
+
+    cpu.cachedNeighbourCount = cpu.possibleNeighbourCount;
+    cpu.cachedOwnBoidCount = cpu.boidCount;
+    cpu.stepsSinceBuild = 0;
+    cpu.nbrListRebuild = 0;
+}
+
+/******************************************************************************/
+/*
+ * Brings the possible neighbouring boids up to date and filters the candidate 
+ * lists down to the boids within VISION_RADIUS, ready for a position update. 
+ * On the step the lists were built the possible neighbours are already fresh. 
+ * On later steps, this BoidCPU's own boids are copied from the current state 
+ * (unless double buffered, where they are the current state). The boids of 
+ * other BoidCPUs were not stored, so their positions are extrapolated from 
+ * their last known velocity.
+ *
+ * @param   cpu     The BoidCPU state
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void refreshNeighbourLists(BoidCPUContext &cpu) {
+    if (cpu.stepsSinceBuild > 0) {
+#ifndef DOUBLE_BUFFERED_BOIDS
+        refreshOwnLoop: for (int j = 0; j < cpu.cachedOwnBoidCount; j++) {
+            cpu.possibleBoidNeighbours[j].position = cpu.boids[j].position;
+            cpu.possibleBoidNeighbours[j].velocity = cpu.boids[j].velocity;
+        }
+#endif
+
+        refreshOtherLoop: for (int j = cpu.cachedOwnBoidCount;
+                j < cpu.cachedNeighbourCount; j++) {
+            cpu.possibleBoidNeighbours[j].position.add(
+                    cpu.possibleBoidNeighbours[j].velocity);
+        }
+    }
+
+    filterBoidLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        uint8 boidNeighbourCount = 0;
+
+        filterNbrLoop: for (int n = 0; n < cpu.candidateCount[i]; n++) {
+            Boid *candidate = &cpu.possibleBoidNeighbours[cpu.candidateList[i][n]];
+            int32_fp boidSeparation = Vector::squaredDistanceBetween(
+                    cpu.boids[i].position, candidate->position);
+
+            if (boidSeparation < VISION_RADIUS_SQUARED) {
+                cpu.boidNeighbourList[i][boidNeighbourCount] = candidate;
+                boidNeighbourCount++;
+            }
+        }
+
+        cpu.boids[i].setNeighbourDetails(cpu.boidNeighbourList[i],
+                boidNeighbourCount);
+    }
+
+    cpu.stepsSinceBuild++;
+}
+
+/******************************************************************************/
+/*
+ * Determines if the cached neighbour lists need to be rebuilt before the next 
+ * position update. While no boid has moved more than half of NBR_LIST_SKIN 
+ * since the lists were built, no pair of boids can have come within 
+ * VISION_RADIUS without already being candidates. Once one has, the lists of 
+ * every BoidCPU are rebuilt, as the boid may be a candidate of a neighbour.
+ *
+ * Only this BoidCPU's lists are rebuilt after NBR_LIST_MAX_REUSE steps, to 
+ * limit the extrapolation error, and when it sends or accepts a boid (see 
+ * transmitBoids() and commitAcceptedBoids()). The flags are reported to the 
+ * BoidMaster in the MODE_TRAN_BOIDS ACK.
+ *
+ * @param   cpu     The BoidCPU state
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void checkNeighbourLists(BoidCPUContext &cpu) {
+    const int32_fp halfSkinSquared = (NBR_LIST_SKIN * NBR_LIST_SKIN) / 4;
+
+    if (cpu.stepsSinceBuild >= NBR_LIST_MAX_REUSE) {
+        cpu.nbrListRebuild |= NBR_REBUILD_OWN;
+    }
+
+    const int32_fp halfWidth = cpu.simulationWidth >> 1;
+    const int32_fp halfHeight = cpu.simulationHeight >> 1;
+
+    checkBoidLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        int32_fp xMoved = cpu.boids[i].position.x - cpu.builtPositions[i].x;
+        int32_fp yMoved = cpu.boids[i].position.y - cpu.builtPositions[i].y;
+
+        // A boid that has wrapped around the simulation area has only moved a 
+        // short way across the edge, not across the whole area
+        if (xMoved > halfWidth) {
+            xMoved -= cpu.simulationWidth;
+        } else if (xMoved < -halfWidth) {
+            xMoved += cpu.simulationWidth;
+        }
+
+        if (yMoved > halfHeight) {
+            yMoved -= cpu.simulationHeight;
+        } else if (yMoved < -halfHeight) {
+            yMoved += cpu.simulationHeight;
+        }
+
+        if (((xMoved * xMoved) + (yMoved * yMoved)) > halfSkinSquared) {
+            cpu.nbrListRebuild |= NBR_REBUILD_ALL;
+        }
+    }
+}
+#endif
+
+#ifdef SOA_NBR_SEARCH
+/******************************************************************************/
+/*
+ * Copies the positions and IDs of the boids and the possible neighbouring 
+ * boids into their structure-of-arrays form. The padding entries are cleared, 
+ * and are masked out of the results of the neighbour search.
+ *
+ * @param   cpu     The BoidCPU state
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void storeBoidsAsArrays(BoidCPUContext &cpu) {
+    soaBoidLoop: for (int i = 0; i < MAX_SOA_BOIDS; i++) {
+        if (i < cpu.boidCount) {
+            cpu.boidX[i] = (((int32_fp)cpu.boids[i].position.x) <<
+                    SOA_FRACTIONAL_BITS).to_int();
+            cpu.boidY[i] = (((int32_fp)cpu.boids[i].position.y) <<
+                    SOA_FRACTIONAL_BITS).to_int();
+            cpu.boidID[i] = cpu.boids[i].id;
+        } else {
+            cpu.boidX[i] = cpu.boidY[i] = 0;
+            cpu.boidID[i] = 0;
+        }
+    }
+
+    soaNbrLoop: for (int j = 0; j < MAX_SOA_BOIDS; j++) {
+        if (j < cpu.possibleNeighbourCount) {
+            Boid nbr = cpu.possibleBoidNeighbours[j];
+            cpu.nbrX[j] = (((int32_fp)nbr.position.x) <<
+                    SOA_FRACTIONAL_BITS).to_int();
+            cpu.nbrY[j] = (((int32_fp)nbr.position.y) <<
+                    SOA_FRACTIONAL_BITS).to_int();
+            cpu.nbrID[j] = nbr.id;
+        } else {
+            cpu.nbrX[j] = cpu.nbrY[j] = 0;
+            cpu.nbrID[j] = 0;
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ * Calculates which of the possible neighbouring boids are neighbours of the 
+ * supplied boid, setting bit j of the mask if possible neighbour j is within 
+ * NBR_SEARCH_RADIUS and is not the boid itself. Uses AVX2 or SSE2 when 
+ * available, otherwise falls back to a scalar loop.
+ *
+ * The differences in position are saturated and clamped to NBR_SEARCH_RADIUS 
+ * (anything beyond it cannot be a neighbour), so the squared distance fits in 
+ * 32 bits and is exact, giving the same result as squaredDistanceBetween().
+ *
+ * @param   cpu     The BoidCPU state
+ * @param   index   The index of the boid in boids[]
+ * @param   mask    The neighbour bitmask, SOA_MASK_WORDS long, to fill
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void findNeighbourMask(BoidCPUContext &cpu, BoidIndex index, uint32_t *mask) {
+    const int16_t radius = NBR_SEARCH_RADIUS << SOA_FRACTIONAL_BITS;
+    const int32_t radiusSquared = NBR_SEARCH_RADIUS_SQUARED <<
+            (2 * SOA_FRACTIONAL_BITS);
+    int count = cpu.possibleNeighbourCount;
+
+    soaClearMaskLoop: for (int w = 0; w < SOA_MASK_WORDS; w++) {
+        mask[w] = 0;
+    }
+
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i limit = _mm256_set1_epi16(radius);
+    const __m256i limitSquared = _mm256_set1_epi32(radiusSquared);
+    const __m256i x = _mm256_set1_epi16(cpu.boidX[index]);
+    const __m256i y = _mm256_set1_epi16(cpu.boidY[index]);
+    const __m256i id = _mm256_set1_epi16(cpu.boidID[index]);
+
+    avxNbrLoop: for (int j = 0; j < count; j += 16) {
+        __m256i dx = _mm256_subs_epi16(
+                _mm256_loadu_si256((const __m256i *)&cpu.nbrX[j]), x);
+        __m256i dy = _mm256_subs_epi16(
+                _mm256_loadu_si256((const __m256i *)&cpu.nbrY[j]), y);
+        dx = _mm256_min_epi16(_mm256_max_epi16(dx,
+                _mm256_subs_epi16(zero, dx)), limit);
+        dy = _mm256_min_epi16(_mm256_max_epi16(dy,
+                _mm256_subs_epi16(zero, dy)), limit);
+
+        // Unpacking and packing work within 128-bit lanes, so they cancel out
+        __m256i lo = _mm256_unpacklo_epi16(dx, dy);
+        __m256i hi = _mm256_unpackhi_epi16(dx, dy);
+        __m256i nearLo = _mm256_cmpgt_epi32(limitSquared,
+                _mm256_madd_epi16(lo, lo));
+        __m256i nearHi = _mm256_cmpgt_epi32(limitSquared,
+                _mm256_madd_epi16(hi, hi));
+        __m256i near = _mm256_packs_epi32(nearLo, nearHi);
+
+        __m256i self = _mm256_cmpeq_epi16(
+                _mm256_loadu_si256((const __m256i *)&cpu.nbrID[j]), id);
+        near = _mm256_andnot_si256(self, near);
+
+        near = _mm256_permute4x64_epi64(_mm256_packs_epi16(near, zero), 0xD8);
+        uint32_t bits = _mm256_movemask_epi8(near) & 0xFFFF;
+        mask[j / 32] |= bits << (j % 32);
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i limit = _mm_set1_epi16(radius);
+    const __m128i limitSquared = _mm_set1_epi32(radiusSquared);
+    const __m128i x = _mm_set1_epi16(cpu.boidX[index]);
+    const __m128i y = _mm_set1_epi16(cpu.boidY[index]);
+    const __m128i id = _mm_set1_epi16(cpu.boidID[index]);
+
+    sseNbrLoop: for (int j = 0; j < count; j += 8) {
+        __m128i dx = _mm_subs_epi16(
+                _mm_loadu_si128((const __m128i *)&cpu.nbrX[j]), x);
+        __m128i dy = _mm_subs_epi16(
+                _mm_loadu_si128((const __m128i *)&cpu.nbrY[j]), y);
+        dx = _mm_min_epi16(_mm_max_epi16(dx, _mm_subs_epi16(zero, dx)), limit);
+        dy = _mm_min_epi16(_mm_max_epi16(dy, _mm_subs_epi16(zero, dy)), limit);
+
+        __m128i lo = _mm_unpacklo_epi16(dx, dy);
+        __m128i hi = _mm_unpackhi_epi16(dx, dy);
+        __m128i nearLo = _mm_cmplt_epi32(_mm_madd_epi16(lo, lo), limitSquared);
+        __m128i nearHi = _mm_cmplt_epi32(_mm_madd_epi16(hi, hi), limitSquared);
+        __m128i near = _mm_packs_epi32(nearLo, nearHi);
+
+        __m128i self = _mm_cmpeq_epi16(
+                _mm_loadu_si128((const __m128i *)&cpu.nbrID[j]), id);
+        near = _mm_andnot_si128(self, near);
+
+        uint32_t bits = _mm_movemask_epi8(_mm_packs_epi16(near, zero)) & 0xFF;
+        mask[j / 32] |= bits << (j % 32);
+    }
+#else
+    scalarNbrLoop: for (int j = 0; j < count; j++) {
+        int32_t dx = (int32_t)cpu.nbrX[j] - cpu.boidX[index];
+        int32_t dy = (int32_t)cpu.nbrY[j] - cpu.boidY[index];
+
+        if (dx < 0) dx = -dx;
+        if (dy < 0) dy = -dy;
+        if (dx > radius) dx = radius;
+        if (dy > radius) dy = radius;
+
+        if (((dx * dx) + (dy * dy) < radiusSquared) &&
+                (cpu.nbrID[j] != cpu.boidID[index])) {
+            mask[j / 32] |= ((uint32_t)1) << (j % 32);
+        }
+    }
+#endif
+
+    // Clear the bits of any padding entries covered by the final vector
+    if (count % 32 != 0) {
+        mask[count / 32] &= (((uint32_t)1) << (count % 32)) - 1;
+    }
+    soaPaddingLoop: for (int w = (count + 31) / 32; w < SOA_MASK_WORDS; w++) {
+        mask[w] = 0;
+    }
+}
+#endif
+
+#ifdef SPATIAL_GRID_ENABLED
+/******************************************************************************/
+/*
+ * Bins the possible neighbouring boids into the spatial grid using a counting 
+ * sort. The grid covers the BoidCPU's bounds plus a halo of one cell on each 
+ * side; boids beyond the halo are placed in the outermost cells. As the boids 
+ * are binned in order, each cell lists its boids in possibleBoidNeighbours 
+ * order.
+ *
+ * @param   cpu     The BoidCPU state
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void binPossibleNeighbours(BoidCPUContext &cpu) {
+    cpu.gridColumns = ((cpu.boidCPUCoords[X_MAX] - cpu.boidCPUCoords[X_MIN]) /
+            GRID_CELL_SIZE) + 3;
+    cpu.gridRows = ((cpu.boidCPUCoords[Y_MAX] - cpu.boidCPUCoords[Y_MIN]) /
+            GRID_CELL_SIZE) + 3;
+
+    if (cpu.gridColumns > MAX_GRID_COLS) cpu.gridColumns = MAX_GRID_COLS;
+    if (cpu.gridRows > MAX_GRID_ROWS) cpu.gridRows = MAX_GRID_ROWS;
+
+    uint16 cellCount = cpu.gridColumns * cpu.gridRows;
+
+    gridClearLoop: for (int c = 0; c < cellCount + 1; c++) {
+        cpu.gridCellStart[c] = 0;
+    }
+
+    // Count the boids in each cell
+    gridCountLoop: for (int j = 0; j < cpu.possibleNeighbourCount; j++) {
+        Boid *nbr = &cpu.possibleBoidNeighbours[j];
+        cpu.gridCellOf[j] = (gridRow(cpu, nbr->position.y) * cpu.gridColumns) +
+                gridColumn(cpu, nbr->position.x);
+        cpu.gridCellStart[cpu.gridCellOf[j] + 1]++;
+    }
+
+    // Turn the counts into start indexes
+    gridPrefixLoop: for (int c = 0; c < cellCount; c++) {
+        cpu.gridCellStart[c + 1] += cpu.gridCellStart[c];
+        cpu.gridCellFill[c] = cpu.gridCellStart[c];
+    }
+
+    // Place each boid in its cell
+    gridPlaceLoop: for (int j = 0; j < cpu.possibleNeighbourCount; j++) {
+        cpu.gridCellBoids[cpu.gridCellFill[cpu.gridCellOf[j]]] = j;
+        cpu.gridCellFill[cpu.gridCellOf[j]]++;
+    }
+}
+
+/******************************************************************************/
+/*
+ * Determines the spatial grid column that contains the supplied x coordinate. 
+ * Coordinates beyond the grid are clamped to the first or last column, which 
+ * keeps boids within NBR_SEARCH_RADIUS of each other in adjacent columns.
+ *
+ * @param   cpu The BoidCPU state
+ * @param   x   The x coordinate to locate
+ *
+ * @return      The grid column containing the coordinate
+ *
+ ******************************************************************************/
+uint8 gridColumn(BoidCPUContext &cpu, int16_fp x) {
+    int16 offset = int16(x) - cpu.boidCPUCoords[X_MIN] + GRID_CELL_SIZE;
+    int16 column = 0;
+
+    if (offset > 0) {
+        column = offset / GRID_CELL_SIZE;
+    }
+
+    if (column > cpu.gridColumns - 1) {
+        column = cpu.gridColumns - 1;
+    }
+
+    return column;
 }
 
+/******************************************************************************/
+/*
+ * Determines the spatial grid row that contains the supplied y coordinate. 
+ * Coordinates beyond the grid are clamped to the first or last row.
+ *
+ * @param   cpu The BoidCPU state
+ * @param   y   The y coordinate to locate
+ *
+ * @return      The grid row containing the coordinate
+ *
+ ******************************************************************************/
+uint8 gridRow(BoidCPUContext &cpu, int16_fp y) {
+    int16 offset = int16(y) - cpu.boidCPUCoords[Y_MIN] + GRID_CELL_SIZE;
+    int16 row = 0;
+
+    if (offset > 0) {
+        row = offset / GRID_CELL_SIZE;
+    }
+
+    if (row > cpu.gridRows - 1) {
+        row = cpu.gridRows - 1;
+    }
+
+    return row;
+}
+#endif
+
 /******************************************************************************/
 /*
  * Iterates through the boids contained in this BoidCPU and updates their
@@ -457,54 +1546,153 @@ void calculateBoidNeighbours() {
  * position is wrapped around. When all the boids have been updated an ACK is
  * issued.
  *
- * @param   None
+ * If DOUBLE_BUFFERED_BOIDS is defined, each boid is updated into the next 
+ * state buffer while all neighbours are read from the current one, so the 
+ * boids can be updated in any order. The host runtime may split the updates 
+ * across threads, see host/boidCPUCore.cpp. The buffers are swapped afterwards.
+ *
+ * If PIPELINED_STEPS is defined, the boids that have escaped are also found 
+ * before the ACK is sent, see findEscapedBoids(), leaving only their 
+ * transmission for the transfer phase.
+ *
+ * If ASYNC_TIME_STEPS is defined, there is no ACK. The escaped boids are 
+ * transferred straight away instead.
+ *
+ * @param   cpu     The BoidCPU state
  *
  * @return  None
  *
  ******************************************************************************/
-void calcNextBoidPositions() {
+void calcNextBoidPositions(BoidCPUContext &cpu) {
     std::cout << "-Calculating next boid positions..." << std::endl;
 
-    updateBoidsLoop: for (int i = 0; i < boidCount; i++) {
-        boids[i].update();
+#ifdef NBR_LIST_CACHING
+    refreshNeighbourLists(cpu);
+#endif
 
-        // Contain boid pixel position values to within the simulation area
-        if (boids[i].position.x > simulationWidth) {
-            boids[i].position.x = 0;
-        } else if (boids[i].position.x < 0) {
-            boids[i].position.x = simulationWidth;
-        }
+#ifdef DOUBLE_BUFFERED_BOIDS
+#ifdef HOST_RUNTIME
+    updateNextBoidsOnHost(cpu);
+#else
+    bufferedUpdateLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        updateNextBoid(cpu, i);
+    }
+#endif
 
-        if (boids[i].position.y > simulationHeight) {
-            boids[i].position.y = 0;
-        } else if (boids[i].position.y < 0) {
-            boids[i].position.y = simulationHeight;
-        }
+    swapBoidBuffers(cpu);
+#else
+    updateBoidsLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        cpu.boids[i].update();
+        wrapBoidPosition(cpu, &cpu.boids[i]);
     }
+#endif
+
+#ifdef NBR_LIST_CACHING
+    checkNeighbourLists(cpu);
+#endif
+
+#ifdef PIPELINED_STEPS
+    cpu.escapedBoidCount = findEscapedBoids(cpu, cpu.escapedBoidIndexes,
+            cpu.escapedRecipientIDs);
+#endif
 
+#ifdef ASYNC_TIME_STEPS
+    calculateEscapedBoids(cpu);
+#else
     // Send ACK signal
-    sendAck(MODE_POS_BOIDS);
+    sendAck(cpu, MODE_POS_BOIDS);
+#endif
+}
+
+/******************************************************************************/
+/*
+ * Contains a boid's pixel position to within the simulation area, wrapping it 
+ * around to the opposite edge if it has moved beyond one.
+ *
+ * @param   cpu     The BoidCPU state
+ * @param   boid    The boid to contain
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void wrapBoidPosition(BoidCPUContext &cpu, Boid *boid) {
+    if (boid->position.x > cpu.simulationWidth) {
+        boid->position.x = 0;
+    } else if (boid->position.x < 0) {
+        boid->position.x = cpu.simulationWidth;
+    }
+
+    if (boid->position.y > cpu.simulationHeight) {
+        boid->position.y = 0;
+    } else if (boid->position.y < 0) {
+        boid->position.y = cpu.simulationHeight;
+    }
 }
 
+#ifdef DOUBLE_BUFFERED_BOIDS
+/******************************************************************************/
+/*
+ * Updates a boid into the next state buffer. Only the state that a position 
+ * update changes is written, the neighbour details are set again before the 
+ * next update.
+ *
+ * @param   cpu     The BoidCPU state
+ * @param   i       The index of the boid to update
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void updateNextBoid(BoidCPUContext &cpu, int i) {
+    cpu.boids[i].updateInto(&cpu.nextBoids[i]);
+    wrapBoidPosition(cpu, &cpu.nextBoids[i]);
+}
+
+/******************************************************************************/
+/*
+ * Makes the next boid state the current one. Any cached neighbour lists still 
+ * refer to the boids received from neighbours, so these are carried over to 
+ * the new current buffer.
+ *
+ * @param   cpu     The BoidCPU state
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void swapBoidBuffers(BoidCPUContext &cpu) {
+    Boid *previous = cpu.boids;
+
+    cpu.boids = cpu.nextBoids;
+    cpu.nextBoids = previous;
+    cpu.possibleBoidNeighbours = cpu.boids;
+
+#ifdef NBR_LIST_CACHING
+    carryNbrsLoop: for (int j = cpu.cachedOwnBoidCount;
+            j < cpu.cachedNeighbourCount; j++) {
+        cpu.boids[j] = previous[j];
+    }
+#endif
+}
+#endif
+
 #ifdef LOAD_BALANCING_ENABLED
 /******************************************************************************/
 /*
  * If the number of boids contained within this BoidCPU is greater than the 
  * boid threshold, signal the controller. Else, just send an acknowledgement.
  *
- * @param   None
+ * @param   cpu     The BoidCPU state
  *
  * @return  None
  *
  ******************************************************************************/
-void evaluateLoad() {
-    if (boidCount > BOID_THRESHOLD) {
+void evaluateLoad(BoidCPUContext &cpu) {
+    if (cpu.boidCount > BOID_THRESHOLD) {
         std::cout << "-Load balancing..." << std::endl;
 
-        generateOutput(0, CONTROLLER_ID, CMD_LOAD_BAL_REQUEST, outputBody);
+        generateOutput(cpu, 0, CONTROLLER_ID, CMD_LOAD_BAL_REQUEST, cpu.outputBody);
     } else {
         std::cout << "-No need to load balance" << std::endl;
-        sendAck(MODE_LOAD_BAL);
+        sendAck(cpu, MODE_LOAD_BAL);
     }
 }
 
@@ -515,49 +1703,49 @@ void evaluateLoad() {
  * change causes one of the BoidCPU's boundaries to become minimal, inform the 
  * BoidMaster. 
  *
- * @param   None
+ * @param   cpu     The BoidCPU state
  *
  * @return  None
  *
  ******************************************************************************/
-void loadBalance() {
-    int16 edgeChanges = (int16)inputData[CMD_HEADER_LEN + 0];
+void loadBalance(BoidCPUContext &cpu) {
+    int16 edgeChanges = (int16)cpu.inputData[CMD_HEADER_LEN + 0];
 
-    std::cout << "BoidCPU #" << boidCPUID << " changing NORTH edge from " <<
-            boidCPUCoords[Y_MIN];
-    boidCPUCoords[Y_MIN] += VISION_RADIUS * int4(edgeChanges >> NORTH_IDX);
-    std::cout << " to " << boidCPUCoords[Y_MIN] << std::endl;
+    std::cout << "BoidCPU #" << cpu.boidCPUID << " changing NORTH edge from " <<
+            cpu.boidCPUCoords[Y_MIN];
+    cpu.boidCPUCoords[Y_MIN] += VISION_RADIUS * int4(edgeChanges >> NORTH_IDX);
+    std::cout << " to " << cpu.boidCPUCoords[Y_MIN] << std::endl;
 
-    std::cout << "BoidCPU #" << boidCPUID << " changing EAST edge from " <<
-            boidCPUCoords[X_MAX];
-    boidCPUCoords[X_MAX] += VISION_RADIUS * int4(edgeChanges >> EAST_IDX);
-    std::cout << " to " << boidCPUCoords[X_MAX] << std::endl;
+    std::cout << "BoidCPU #" << cpu.boidCPUID << " changing EAST edge from " <<
+            cpu.boidCPUCoords[X_MAX];
+    cpu.boidCPUCoords[X_MAX] += VISION_RADIUS * int4(edgeChanges >> EAST_IDX);
+    std::cout << " to " << cpu.boidCPUCoords[X_MAX] << std::endl;
 
-    std::cout << "BoidCPU #" << boidCPUID << " changing SOUTH edge from " <<
-            boidCPUCoords[Y_MAX];
-    boidCPUCoords[Y_MAX] += VISION_RADIUS * int4(edgeChanges >> SOUTH_IDX);
-    std::cout << " to " << boidCPUCoords[Y_MAX] << std::endl;
+    std::cout << "BoidCPU #" << cpu.boidCPUID << " changing SOUTH edge from " <<
+            cpu.boidCPUCoords[Y_MAX];
+    cpu.boidCPUCoords[Y_MAX] += VISION_RADIUS * int4(edgeChanges >> SOUTH_IDX);
+    std::cout << " to " << cpu.boidCPUCoords[Y_MAX] << std::endl;
 
-    std::cout << "BoidCPU #" << boidCPUID << " changing WEST edge from " <<
-            boidCPUCoords[X_MIN];
-    boidCPUCoords[X_MIN] += VISION_RADIUS * int4(edgeChanges >> WEST_IDX);
-    std::cout << " to " << boidCPUCoords[X_MIN] << std::endl;
+    std::cout << "BoidCPU #" << cpu.boidCPUID << " changing WEST edge from " <<
+            cpu.boidCPUCoords[X_MIN];
+    cpu.boidCPUCoords[X_MIN] += VISION_RADIUS * int4(edgeChanges >> WEST_IDX);
+    std::cout << " to " << cpu.boidCPUCoords[X_MIN] << std::endl;
 
     // Is minimal?
-    int12 width  = boidCPUCoords[2] - boidCPUCoords[0];
-    int12 height = boidCPUCoords[3] - boidCPUCoords[1];
+    int12 width  = cpu.boidCPUCoords[2] - cpu.boidCPUCoords[0];
+    int12 height = cpu.boidCPUCoords[3] - cpu.boidCPUCoords[1];
     if ((width <= VISION_RADIUS) && (height <= VISION_RADIUS)) {
-        std::cout << "BoidCPU #" << boidCPUID << " minimal" << std::endl;
-        outputBody[0] = 2;
-        generateOutput(1, CONTROLLER_ID, CMD_BOUNDS_AT_MIN, outputBody);
+        std::cout << "BoidCPU #" << cpu.boidCPUID << " minimal" << std::endl;
+        cpu.outputBody[0] = 2;
+        generateOutput(cpu, 1, CONTROLLER_ID, CMD_BOUNDS_AT_MIN, cpu.outputBody);
     } else if (width <= VISION_RADIUS) {
-        std::cout << "BoidCPU #" << boidCPUID << " width minimal" << std::endl;
-        outputBody[0] = 0;
-        generateOutput(1, CONTROLLER_ID, CMD_BOUNDS_AT_MIN, outputBody);
+        std::cout << "BoidCPU #" << cpu.boidCPUID << " width minimal" << std::endl;
+        cpu.outputBody[0] = 0;
+        generateOutput(cpu, 1, CONTROLLER_ID, CMD_BOUNDS_AT_MIN, cpu.outputBody);
     } else if (height <= VISION_RADIUS) {
-        std::cout << "BoidCPU #" << boidCPUID << " height minimal" << std::endl;
-        outputBody[0] = 1;
-        generateOutput(1, CONTROLLER_ID, CMD_BOUNDS_AT_MIN, outputBody);
+        std::cout << "BoidCPU #" << cpu.boidCPUID << " height minimal" << std::endl;
+        cpu.outputBody[0] = 1;
+        generateOutput(cpu, 1, CONTROLLER_ID, CMD_BOUNDS_AT_MIN, cpu.outputBody);
     }
 }
 #endif
@@ -568,20 +1756,20 @@ void loadBalance() {
  * BoidGPU for drawing. Before this is done any boids that arrived during the
  * transfer stage of the simulation are committed.
  *
- * @param   None
+ * @param   cpu     The BoidCPU state
  *
  * @return  None
  *
  ******************************************************************************/
-void updateDisplay() {
-    if (queuedBoidsCounter > 0) {
-        commitAcceptedBoids();
+void updateDisplay(BoidCPUContext &cpu) {
+    if (cpu.queuedBoidsCounter > 0) {
+        commitAcceptedBoids(cpu);
 
         std::cout << "-Updating display" << std::endl;
-        packBoidsForSending(BOIDGPU_ID, CMD_DRAW_INFO);
+        packBoidsForSending(cpu, BOIDGPU_ID, CMD_DRAW_INFO);
     } else {
         std::cout << "-Updating display" << std::endl;
-        packBoidsForSending(BOIDGPU_ID, CMD_DRAW_INFO);
+        packBoidsForSending(cpu, BOIDGPU_ID, CMD_DRAW_INFO);
     }
 }
 
@@ -593,73 +1781,123 @@ void updateDisplay() {
 /*
  * Called after new boid positions have been calculated load balancing has 
  * occurred. Any boids that are now outside of the current BoidCPU's bounds are 
- * transferred to a neighbouring BoidCPU. 
+ * transferred to a neighbouring BoidCPU, see findEscapedBoids(). If there are 
+ * no such boids, an ACK is sent straight away.
  *
- * @param   None
+ * If PIPELINED_STEPS is defined, the escaped boids have already been found by 
+ * calcNextBoidPositions() and are only transmitted here.
+ *
+ * If ASYNC_TIME_STEPS is defined, the boids are transmitted even if there are 
+ * none, as every distinct neighbour waits for a (possibly empty) batch.
+ *
+ * @param   cpu     The BoidCPU state
  *
  * @return  None
  *
  ******************************************************************************/
-void calculateEscapedBoids() {
+void calculateEscapedBoids(BoidCPUContext &cpu) {
     std::cout << "-Transferring boids..." << std::endl;
 
-    uint16 boidIDs[MAX_BOIDS];
+#ifdef PIPELINED_STEPS
+    BoidIndex *boidIndexes = cpu.escapedBoidIndexes;
+    uint8 *recipientIDs = cpu.escapedRecipientIDs;
+    BoidIndex counter = cpu.escapedBoidCount;
+    cpu.escapedBoidCount = 0;
+#else
+    BoidIndex boidIndexes[MAX_BOIDS];
     uint8 recipientIDs[MAX_BOIDS];
-    uint8 counter = 0;
+    BoidIndex counter = findEscapedBoids(cpu, boidIndexes, recipientIDs);
+#endif
+
+#ifdef ASYNC_TIME_STEPS
+    transmitBoids(cpu, boidIndexes, recipientIDs, counter);
+#else
+    if (counter > 0) {
+        transmitBoids(cpu, boidIndexes, recipientIDs, counter);
+    } else {
+        sendAck(cpu, MODE_TRAN_BOIDS);
+    }
+#endif
+}
+
+/******************************************************************************/
+/*
+ * Finds the boids that are outside of the current BoidCPU's bounds and the 
+ * neighbouring BoidCPUs that they should be transferred to. 
+ *
+ * A boid is only transferred to one BoidCPU. The corner bearings are checked 
+ * before the edge bearings so that a boid beyond two edges goes to the 
+ * diagonal neighbour rather than to both edge neighbours. The slots of the 
+ * escaped boids are recorded in ascending order so that transmitBoids() can 
+ * remove them without searching for them.
+ *
+ * @param   cpu             The BoidCPU state
+ * @param   boidIndexes     Where to store the slots of the escaped boids
+ * @param   recipientIDs    Where to store the IDs of their recipients
+ *
+ * @return  The number of escaped boids
+ *
+ ******************************************************************************/
+BoidIndex findEscapedBoids(BoidCPUContext &cpu, BoidIndex *boidIndexes,
+        uint8 *recipientIDs) {
+    BoidIndex counter = 0;
 
     // For each boid
-    moveBoidsLoop: for (int i = 0; i < boidCount; i++) {
-        // For each bearing (from NORTHWEST (0) to WEST (7))
-        bearLoop: for (int bearing = NORTHWEST; bearing < WEST + 1; bearing++) {
+    moveBoidsLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        // For each bearing, the corners (even) and then the edges (odd)
+        bearLoop: for (int b = 0; b < MAX_BOIDCPU_NEIGHBOURS; b++) {
+            uint8 bearing = (b < (MAX_BOIDCPU_NEIGHBOURS / 2)) ? (b * 2) :
+                    (((b - (MAX_BOIDCPU_NEIGHBOURS / 2)) * 2) + 1);
+
             // If a BoidCPU is at the bearing & boid is beyond the bearing limit
-            if (isNeighbourTo(bearing) && isBoidBeyond(boids[i], bearing)) {
+            if (isNeighbourTo(cpu, bearing) &&
+                    isBoidBeyond(cpu, cpu.boids[i], bearing)) {
                 // Mark boid as to be transferred
-                boidIDs[counter] = boids[i].id;
-                recipientIDs[counter] = neighbouringBoidCPUs[bearing];
+                boidIndexes[counter] = i;
+                recipientIDs[counter] = cpu.neighbouringBoidCPUs[bearing];
                 counter++;
+                break;
             }
         }
     }
 
-    if (counter > 0) {
-        transmitBoids(boidIDs, recipientIDs, counter);
-    } else {
-        sendAck(MODE_TRAN_BOIDS);
-    }
+    return counter;
 }
 
 /******************************************************************************/
 /*
  * Checks if the supplied boid is beyond the supplied BoidCPU edge. Can handle
  * compound edge bearings such as NORTHWEST.
- * 
- * TODO: Every case statement is the same (NORTH and WEST) - investigate when 
- *  next have access to FPGA kit - can't recall issues with this.
  *
+ * @param   cpu     The BoidCPU state
  * @param   boid    The boid to check bounds for
  * @param   edge    The edge to check that the boid is beyond
  *
  * @return          True if the boid is beyond the edge, false otherwise
  *
  ******************************************************************************/
-bool isBoidBeyond(Boid boid, uint8 edge) {
+bool isBoidBeyond(BoidCPUContext &cpu, Boid boid, uint8 edge) {
     bool result;
 
     switch (edge) {
     case NORTHWEST:
-        result = isBoidBeyondSingle(boid, NORTH) && isBoidBeyondSingle(boid, WEST);
+        result = isBoidBeyondSingle(cpu, boid, NORTH) &&
+                isBoidBeyondSingle(cpu, boid, WEST);
         break;
     case NORTHEAST:
-        result = isBoidBeyondSingle(boid, NORTH) && isBoidBeyondSingle(boid, WEST);
+        result = isBoidBeyondSingle(cpu, boid, NORTH) &&
+                isBoidBeyondSingle(cpu, boid, EAST);
         break;
     case SOUTHEAST:
-        result = isBoidBeyondSingle(boid, NORTH) && isBoidBeyondSingle(boid, WEST);
+        result = isBoidBeyondSingle(cpu, boid, SOUTH) &&
+                isBoidBeyondSingle(cpu, boid, EAST);
         break;
     case SOUTHWEST:
-        result = isBoidBeyondSingle(boid, NORTH) && isBoidBeyondSingle(boid, WEST);
+        result = isBoidBeyondSingle(cpu, boid, SOUTH) &&
+                isBoidBeyondSingle(cpu, boid, WEST);
         break;
     default:
-        result = isBoidBeyondSingle(boid, edge);
+        result = isBoidBeyondSingle(cpu, boid, edge);
         break;
     }
 
@@ -671,13 +1909,14 @@ bool isBoidBeyond(Boid boid, uint8 edge) {
  * Checks if the supplied boid is beyond the supplied BoidCPU edge. Can only
  * handle singular edge bearings e.g. NORTH.
  *
+ * @param   cpu     The BoidCPU state
  * @param   boid    The boid to check bounds for
  * @param   edge    The edge to check that the boid is beyond
  *
  * @return          True if the boid is beyond the edge, false otherwise
  *
  ******************************************************************************/
-bool isBoidBeyondSingle(Boid boid, uint8 edge) {
+bool isBoidBeyondSingle(BoidCPUContext &cpu, Boid boid, uint8 edge) {
     int16_fp coordinate;
     bool result;
 
@@ -707,13 +1946,13 @@ bool isBoidBeyondSingle(Boid boid, uint8 edge) {
 
     // Determine if the comparison should be less than or greater than
     if ((edge == X_MIN) || (edge == Y_MIN)) {
-        if (coordinate < boidCPUCoords[edge]) {
+        if (coordinate < cpu.boidCPUCoords[edge]) {
             result = true;
         } else {
             result = false;
         }
     } else if ((edge == X_MAX) || (edge == Y_MAX)) {
-        if (coordinate > boidCPUCoords[edge]) {
+        if (coordinate > cpu.boidCPUCoords[edge]) {
             result = true;
         } else {
             result = false;
@@ -727,72 +1966,205 @@ bool isBoidBeyondSingle(Boid boid, uint8 edge) {
 /*
  * Checks if the BoidCPU has a neighbour at the specified bearing
  *
+ * @param   cpu         The BoidCPU state
  * @param   bearing     From NORTHWEST (0) around a compass to WEST (7)
  *
  * @return              True if the BoidCPU has a neighbour at the specified
  *                       bearing, false otherwise
  *
  ******************************************************************************/
-bool isNeighbourTo(uint16 bearing) {
-    if (neighbouringBoidCPUs[bearing] > 0) {
+bool isNeighbourTo(BoidCPUContext &cpu, uint16 bearing) {
+    if (cpu.neighbouringBoidCPUs[bearing] > 0) {
         return true;
     } else {
         return false;
     }
 }
 
+#ifdef HALO_NBR_EXCHANGE
+/******************************************************************************/
+/*
+ * Checks if the supplied boid is within the halo of the supplied BoidCPU edge, 
+ * i.e. within NBR_SEARCH_RADIUS of it and so visible to boids beyond it. Can 
+ * handle compound edge bearings such as NORTHWEST, where the boid must be in 
+ * the halo of both edges.
+ *
+ * @param   cpu     The BoidCPU state
+ * @param   boid    The boid to check
+ * @param   edge    The edge (bearing) to check the halo of
+ *
+ * @return          True if the boid is within the halo, false otherwise
+ *
+ ******************************************************************************/
+bool isBoidInHalo(BoidCPUContext &cpu, Boid boid, uint8 edge) {
+    bool result;
+
+    switch (edge) {
+    case NORTHWEST:
+        result = isBoidInHaloSingle(cpu, boid, NORTH) &&
+                isBoidInHaloSingle(cpu, boid, WEST);
+        break;
+    case NORTHEAST:
+        result = isBoidInHaloSingle(cpu, boid, NORTH) &&
+                isBoidInHaloSingle(cpu, boid, EAST);
+        break;
+    case SOUTHEAST:
+        result = isBoidInHaloSingle(cpu, boid, SOUTH) &&
+                isBoidInHaloSingle(cpu, boid, EAST);
+        break;
+    case SOUTHWEST:
+        result = isBoidInHaloSingle(cpu, boid, SOUTH) &&
+                isBoidInHaloSingle(cpu, boid, WEST);
+        break;
+    default:
+        result = isBoidInHaloSingle(cpu, boid, edge);
+        break;
+    }
+
+    return result;
+}
+
+/******************************************************************************/
+/*
+ * Checks if the supplied boid is within NBR_SEARCH_RADIUS of the supplied BoidCPU 
+ * edge. Can only handle singular edge bearings e.g. NORTH.
+ *
+ * @param   cpu     The BoidCPU state
+ * @param   boid    The boid to check
+ * @param   edge    The edge to check the halo of
+ *
+ * @return          True if the boid is within the halo, false otherwise
+ *
+ ******************************************************************************/
+bool isBoidInHaloSingle(BoidCPUContext &cpu, Boid boid, uint8 edge) {
+    bool result = false;
+
+    switch (edge) {
+    case NORTH:
+        result = (boid.position.y < cpu.boidCPUCoords[Y_MIN] + NBR_SEARCH_RADIUS);
+        break;
+    case EAST:
+        result = (boid.position.x > cpu.boidCPUCoords[X_MAX] - NBR_SEARCH_RADIUS);
+        break;
+    case SOUTH:
+        result = (boid.position.y > cpu.boidCPUCoords[Y_MAX] - NBR_SEARCH_RADIUS);
+        break;
+    case WEST:
+        result = (boid.position.x < cpu.boidCPUCoords[X_MIN] + NBR_SEARCH_RADIUS);
+        break;
+    default:
+        break;
+    }
+
+    return result;
+}
+#endif
+
 /******************************************************************************/
 /*
  * Called after boids in a BoidCPU have been identified for transportation to 
  * neighbouring BoidCPUs. 
  *
- * @param   boidIDs         An array of the IDs of boids to transfer
+ * If BATCHED_BOID_TRANSFER is defined, all the boids bound for a neighbouring 
+ * BoidCPU are packed into as few CMD_BOID_BATCH messages as possible, in the 
+ * same format as CMD_NBR_REPLY, rather than sent as one CMD_BOID each.
+ *
+ * Each boid is removed in constant time by moving the last boid into its 
+ * slot. The slots are visited from the highest down, so the boid that is 
+ * moved is never one that is still waiting to be removed.
+ *
+ * If ASYNC_TIME_STEPS is defined, every distinct neighbour is sent a batch, 
+ * even an empty one, and the time step is finished once the batches of all 
+ * the neighbours have also arrived, rather than an ACK being sent.
+ *
+ * @param   cpu             The BoidCPU state
+ * @param   boidIndexes     The slots of the boids to transfer, in ascending 
+ *                          order
  * @param   recipientIDs    An array of the IDs of the neighbouring BoidCPUs
  * @param   count           The number of boids to transfer
  *
  * @return  None
  *
  ******************************************************************************/
-void transmitBoids(uint16 *boidIDs, uint8 *recipientIDs, uint8 count) {
+void transmitBoids(BoidCPUContext &cpu, BoidIndex *boidIndexes,
+        uint8 *recipientIDs, BoidIndex count) {
     // First transmit all the boids
-    boidTransmitLoop: for (int i = 0; i < count; i++) {
-        boidTransmitSearchLoop: for (int j = 0; j < boidCount; j++) {
-            if (boidIDs[i] == boids[j].id) {
-                // TODO: Perhaps move this to the boid class?
-                outputBody[0] = boids[j].id;
-                outputBody[1] = boids[j].position.x;
-                outputBody[2] = boids[j].position.y;
-                outputBody[3] = boids[j].velocity.x;
-                outputBody[4] = boids[j].velocity.y;
+#ifdef BATCHED_BOID_TRANSFER
+    BoidIndex batchBoids[MAX_BOIDS];
 
-                generateOutput(5, recipientIDs[i], CMD_BOID, outputBody);
+    batchNbrLoop: for (int bearing = NORTHWEST; bearing < WEST + 1; bearing++) {
+        uint8 neighbour = cpu.neighbouringBoidCPUs[bearing];
 
-                std::cout << "-Transferring boid #" << boids[j].id <<
-                        " to boidCPU #" << recipientIDs[i] << std::endl;
-
-                break;
+        // Only send once to each distinct neighbour
+        bool alreadySent = !isNeighbourTo(cpu, bearing);
+        batchSentLoop: for (int b = NORTHWEST; b < bearing; b++) {
+            if (cpu.neighbouringBoidCPUs[b] == neighbour) {
+                alreadySent = true;
             }
         }
-    }
 
-    // Then delete the boids from the BoidCPUs own boid list
-    outerBoidRemovalLoop: for (int i = 0; i < count; i++) {
-        bool boidFound = false;
-        //  'j < boidCount - 1' used as list is decremented by 1
-        innerBoidRemovalLoop: for (int j = 0; j < boidCount - 1; j++) {
-            if (boids[j].id == boidIDs[i]) {
-                boidFound = true;
+        if (!alreadySent) {
+            BoidIndex batchCount = 0;
+            batchBoidLoop: for (int i = 0; i < count; i++) {
+                if (recipientIDs[i] == neighbour) {
+                    batchBoids[batchCount] = boidIndexes[i];
+                    batchCount++;
+
+                    std::cout << "-Transferring boid #" <<
+                            cpu.boids[boidIndexes[i]].id << " to boidCPU #" <<
+                            neighbour << std::endl;
+                }
             }
 
-            if (boidFound) {
-                boids[j] = boids[j + 1];
+#ifdef ASYNC_TIME_STEPS
+            packBoidsForSending(cpu, neighbour, CMD_BOID_BATCH, batchBoids,
+                    batchCount);
+#else
+            if (batchCount > 0) {
+                packBoidsForSending(cpu, neighbour, CMD_BOID_BATCH, batchBoids,
+                        batchCount);
             }
+#endif
         }
-        boidCount--;
     }
+#else
+    boidTransmitLoop: for (int i = 0; i < count; i++) {
+        Boid *boid = &cpu.boids[boidIndexes[i]];
+
+        // TODO: Perhaps move this to the boid class?
+        cpu.outputBody[0] = boid->id;
+        cpu.outputBody[1] = boid->position.x;
+        cpu.outputBody[2] = boid->position.y;
+        cpu.outputBody[3] = boid->velocity.x;
+        cpu.outputBody[4] = boid->velocity.y;
+
+        generateOutput(cpu, 5, recipientIDs[i], CMD_BOID, cpu.outputBody);
+
+        std::cout << "-Transferring boid #" << boid->id << " to boidCPU #" <<
+                recipientIDs[i] << std::endl;
+    }
+#endif
+
+    // Then delete the boids from the BoidCPUs own boid list
+    boidRemovalLoop: for (int i = count - 1; i >= 0; i--) {
+        cpu.boidCount--;
+        cpu.boids[boidIndexes[i]] = cpu.boids[cpu.boidCount];
+    }
+
+#ifdef NBR_LIST_CACHING
+    // The boid indexes have changed, so the neighbour lists must be rebuilt
+    if (count > 0) {
+        cpu.nbrListRebuild |= NBR_REBUILD_OWN;
+    }
+#endif
 
+#ifdef ASYNC_TIME_STEPS
+    cpu.transfersSent = true;
+    finishTimeStep(cpu);
+#else
     // Send ACK signal
-    sendAck(MODE_TRAN_BOIDS);
+    sendAck(cpu, MODE_TRAN_BOIDS);
+#endif
 }
 
 /******************************************************************************/
@@ -803,20 +2175,77 @@ void transmitBoids(uint16 *boidIDs, uint8 *recipientIDs, uint8 count) {
  * simulation BoidCPUs would be transferring and deleting boids from their lists 
  * and inserting a new boid whilst this is happening leads to issues. 
  * 
- * @param   None
+ * A CMD_BOID message holds a single boid. A CMD_BOID_BATCH message holds one or 
+ * more packed boids, as sent by packBoidsForSending(). If ASYNC_TIME_STEPS is 
+ * defined, a batch for a later time step is deferred until this BoidCPU 
+ * starts that time step, and the last batch message from a neighbour ends its 
+ * transfers.
+ * 
+ * @param   cpu     The BoidCPU state
  *
  * @return  None
  *
  ******************************************************************************/
-void acceptBoid() {
-    // TODO: Replace 5 with BOID_DATA_LENGTH when using common transmission
-    if (queuedBoidsCounter < (MAX_QUEUED_BOIDS - 1)) {
-        queueBoidsLoop: for (int i = 0; i < 5; i++) {
-            queuedBoids[queuedBoidsCounter][i] = inputData[CMD_HEADER_LEN + i];
+void acceptBoid(BoidCPUContext &cpu) {
+#ifdef BATCHED_BOID_TRANSFER
+    if (cpu.inputData[CMD_TYPE] == CMD_BOID_BATCH) {
+#ifdef ASYNC_TIME_STEPS
+        if (cpu.inputData[cpu.inputData[CMD_LEN] - 1] != cpu.timeStep) {
+            deferMessage(cpu);
+            return;
+        }
+#endif
+
+        uint8 boidsPerMsg = (cpu.inputData[CMD_LEN] - CMD_HEADER_LEN - 1) /
+                BOID_DATA_LENGTH;
+
+        queueBatchLoop: for (int i = 0; i < boidsPerMsg; i++) {
+            queueBoid(cpu, parsePackedBoid(cpu, i));
+        }
+
+#ifdef ASYNC_TIME_STEPS
+        if (cpu.inputData[CMD_HEADER_LEN + 0] == 0) {
+            cpu.transferCounter++;
+            finishTimeStep(cpu);
         }
+#endif
+
+        return;
+    }
+#endif
+
+    // TODO: Replace 5 with BOID_DATA_LENGTH when using common transmission
+    uint16 boidID = cpu.inputData[CMD_HEADER_LEN + 0];
+    Vector boidPosition = Vector((int16)cpu.inputData[CMD_HEADER_LEN + 1],
+            (int16)cpu.inputData[CMD_HEADER_LEN + 2]);
+    Vector boidVelocity = Vector((int16)cpu.inputData[CMD_HEADER_LEN + 3],
+            (int16)cpu.inputData[CMD_HEADER_LEN + 4]);
+
+    queueBoid(cpu, Boid(boidID, boidPosition, boidVelocity));
+}
 
-        queuedBoidsCounter++;
+/******************************************************************************/
+/*
+ * Adds an accepted boid to the queue of boids to commit. The boid has already 
+ * been removed by its sender, so running out of room is an error: dropping 
+ * the boid would lose it from the simulation.
+ *
+ * @param   cpu     The BoidCPU state
+ * @param   boid    The accepted boid
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void queueBoid(BoidCPUContext &cpu, Boid boid) {
+    if (cpu.queuedBoidsCounter >= MAX_QUEUED_BOIDS) {
+        std::cout << "Cannot accept boid #" << boid.id << ", queue is full (" <<
+                cpu.queuedBoidsCounter << "/" << MAX_QUEUED_BOIDS << ")" <<
+                std::endl;
     }
+    assert(cpu.queuedBoidsCounter < MAX_QUEUED_BOIDS);
+
+    cpu.queuedBoids[cpu.queuedBoidsCounter] = boid;
+    cpu.queuedBoidsCounter++;
 }
 
 /******************************************************************************/
@@ -824,34 +2253,121 @@ void acceptBoid() {
  * Commits boids that have been accepted by the current BoidCPU. 
  * 
  * Called on the UPDATE_DISPLAY stage of the simulation to ensure that all 
- * BoidCPUs have finished sending their boids to neighbours. 
+ * BoidCPUs have finished sending their boids to neighbours. As with the 
+ * queue, running out of room for a boid is an error.
  *
- * @param   None
+ * @param   cpu     The BoidCPU state
  * 
  * @return  None
  *
  ******************************************************************************/
-void commitAcceptedBoids() {
+void commitAcceptedBoids(BoidCPUContext &cpu) {
     std::cout << "-Committing accepted boids..." << std::endl;
 
-    commitQueuedBoidLoop: for (int i = 0; i < queuedBoidsCounter; i++) {
-        if (boidCount < (MAX_BOIDS - 1)) {
-            // TODO: Replace 5 with BOID_DATA_LENGTH when using common transmission
-            uint16 boidID = queuedBoids[i][0];
-            Vector boidPosition = Vector(queuedBoids[i][1], queuedBoids[i][2]);
-            Vector boidVelocity = Vector(queuedBoids[i][3], queuedBoids[i][4]);
-            Boid boid = Boid(boidID, boidPosition, boidVelocity);
+    commitQueuedBoidLoop: for (int i = 0; i < cpu.queuedBoidsCounter; i++) {
+        if (cpu.boidCount >= MAX_BOIDS) {
+            std::cout << "Cannot commit boid #" << cpu.queuedBoids[i].id <<
+                    ", BoidCPU is full (" << cpu.boidCount << "/" <<
+                    MAX_BOIDS << ")" << std::endl;
+        }
+        assert(cpu.boidCount < MAX_BOIDS);
+
+        cpu.boids[cpu.boidCount] = cpu.queuedBoids[i];
+        cpu.boidCount++;
+
+        std::cout << "-BoidCPU #" << cpu.boidCPUID << " accepted boid #" <<
+                cpu.queuedBoids[i].id << " from boidCPU #" <<
+                cpu.inputData[CMD_FROM] << std::endl;
+    }
+
+#ifdef NBR_LIST_CACHING
+    // The accepted boids have no neighbour lists. The sender has already asked 
+    // the BoidMaster for a rebuild, so only this BoidCPU needs to know.
+    if (cpu.queuedBoidsCounter > 0) {
+        cpu.nbrListRebuild |= NBR_REBUILD_OWN;
+    }
+#endif
+
+    cpu.queuedBoidsCounter = 0;
+}
 
-            boids[boidCount] = boid;
-            boidCount++;
+#ifdef ASYNC_TIME_STEPS
+/******************************************************************************/
+/*
+ * Finishes the current time step once this BoidCPU has sent its transfers and 
+ * every distinct neighbour has finished sending its own. The accepted boids 
+ * are committed and drawn, as in the MODE_DRAW phase, and the next time step 
+ * is started by sending the boids to the neighbouring BoidCPUs. Any replies 
+ * and transfers for the next time step that arrived early are then processed, 
+ * in the order that they arrived.
+ *
+ * This replaces the BoidMaster's barriers with synchronisation between 
+ * neighbouring BoidCPUs only. A BoidCPU can be at most one time step ahead of 
+ * its neighbours, as it needs their boids to start the next one.
+ *
+ * @param   cpu     The BoidCPU state
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void finishTimeStep(BoidCPUContext &cpu) {
+    if (cpu.transfersSent &&
+            (cpu.transferCounter == cpu.distinctNeighbourCount)) {
+        updateDisplay(cpu);
+
+        cpu.timeStep++;
+        cpu.transferCounter = 0;
+        cpu.transfersSent = false;
+
+        sendBoidsToNeighbours(cpu);
+
+        // A replayed message may finish this time step too, so the deferred 
+        // messages are released before they are replayed
+        uint16 replayCount = cpu.deferredCount;
+        cpu.deferredCount = 0;
+
+        replayDeferredLoop: for (int i = 0; i < replayCount; i++) {
+            replayCopyLoop: for (int j = 0; j < cpu.deferredData[i][CMD_LEN];
+                    j++) {
+                cpu.inputData[j] = cpu.deferredData[i][j];
+            }
 
-            std::cout << "-BoidCPU #" << boidCPUID << " accepted boid #" << boidID
-                    << " from boidCPU #" << inputData[CMD_FROM] << std::endl;
+            if (cpu.inputData[CMD_TYPE] == CMD_BOID_BATCH) {
+                acceptBoid(cpu);
+            } else {
+                processNeighbouringBoids(cpu);
+            }
         }
     }
+}
+
+/******************************************************************************/
+/*
+ * Holds a copy of the current message, a CMD_NBR_REPLY or CMD_BOID_BATCH for 
+ * the next time step, until this BoidCPU starts that time step. The buffer 
+ * holds a full time step of messages from every neighbour, so running out of 
+ * room is an error: dropping the message would leave the time step waiting 
+ * forever.
+ *
+ * @param   cpu     The BoidCPU state
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void deferMessage(BoidCPUContext &cpu) {
+    if (cpu.deferredCount >= MAX_DEFERRED_CMDS) {
+        std::cout << "Cannot defer message, deferred buffer is full (" <<
+                cpu.deferredCount << "/" << MAX_DEFERRED_CMDS << ")" <<
+                std::endl;
+    }
+    assert(cpu.deferredCount < MAX_DEFERRED_CMDS);
 
-    queuedBoidsCounter = 0;
+    deferCopyLoop: for (int i = 0; i < cpu.inputData[CMD_LEN]; i++) {
+        cpu.deferredData[cpu.deferredCount][i] = cpu.inputData[i];
+    }
+    cpu.deferredCount++;
 }
+#endif
 
 //============================================================================//
 //- Supporting functions -----------------------------------------------------//
@@ -861,17 +2377,17 @@ void commitAcceptedBoids() {
 /*
  * A debug function used to print the state of a BoidCPUs boids.
  *
- * @param   None
+ * @param   cpu     The BoidCPU state
  *
  * @return  None
  *
  ******************************************************************************/
-void printStateOfBoidCPUBoids() {
-    boidStatePrintLoop: for (int i = 0; i < boidCount; i++) {
-        std::cout << "Boid " << boids[i].id << " has position [" <<
-                boids[i].position.x << ", " << boids[i].position.y <<
-                "] and velocity [" << boids[i].velocity.x << ", " <<
-                boids[i].velocity.y << "]" << std::endl;
+void printStateOfBoidCPUBoids(BoidCPUContext &cpu) {
+    boidStatePrintLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        std::cout << "Boid " << cpu.boids[i].id << " has position [" <<
+                cpu.boids[i].position.x << ", " << cpu.boids[i].position.y <<
+                "] and velocity [" << cpu.boids[i].velocity.x << ", " <<
+                cpu.boids[i].velocity.y << "]" << std::endl;
     }
 }
 
@@ -879,16 +2395,40 @@ void printStateOfBoidCPUBoids() {
 /*
  * Sends an acknowledgement (ACK) message with the current state of the 
  * simulation. Used by the BoidMaster to synchronise the state of the 
- * simulation.
+ * simulation. If NBR_LIST_CACHING is defined, the MODE_TRAN_BOIDS ACK also 
+ * carries the flags indicating which neighbour lists need to be rebuilt.
+ *
+ * If ACK_TREE is defined, every ACK also carries the boid count of the 
+ * BoidCPU so that the Gatekeepers can total the boids and find the most 
+ * loaded BoidCPU in their part of the ACK tree.
  *
+ * @param   cpu     The BoidCPU state
  * @param   type    The state of the simulation to acknowledge
  *
  * @return  None
  *
  ******************************************************************************/
-void sendAck(uint8 type) {
-    outputBody[0] = type;
-    generateOutput(1, CONTROLLER_ID, CMD_ACK, outputBody);
+void sendAck(BoidCPUContext &cpu, uint8 type) {
+    uint32 length = 1;
+    cpu.outputBody[0] = type;
+
+#ifdef NBR_LIST_CACHING
+    // Tell the BoidMaster whether the neighbour lists need to be rebuilt
+    if (type == MODE_TRAN_BOIDS) {
+        cpu.outputBody[CMD_ACK_RBLD_IDX] = cpu.nbrListRebuild;
+        length = CMD_ACK_RBLD_IDX + 1;
+    }
+#endif
+
+#ifdef ACK_TREE
+    if (length == 1) {
+        cpu.outputBody[CMD_ACK_RBLD_IDX] = 0;
+    }
+    cpu.outputBody[CMD_ACK_BDCNT_IDX] = cpu.boidCount;
+    length = CMD_ACK_BDCNT_IDX + 1;
+#endif
+
+    generateOutput(cpu, length, CONTROLLER_ID, CMD_ACK, cpu.outputBody);
 }
 
 /******************************************************************************/
@@ -896,17 +2436,18 @@ void sendAck(uint8 type) {
  * Parses a recived boid that was packed for transmission. Returns a Boid 
  * instance derived from the packed boid data. 
  *
+ * @param   cpu     The BoidCPU state
  * @param   offset  The start of the boid data in the input array
  *
  * @return          A Boid instance of the parsed boid data
  *
  ******************************************************************************/
-Boid parsePackedBoid(uint8 offset) {
+Boid parsePackedBoid(BoidCPUContext &cpu, uint8 offset) {
     uint8 index = CMD_HEADER_LEN + (BOID_DATA_LENGTH * offset);
 
-    uint32 pos = inputData[index + 1];
-    uint32 vel = inputData[index + 2];
-    uint16 bID = inputData[index + 3];      // boid ID
+    uint32 pos = cpu.inputData[index + 1];
+    uint32 vel = cpu.inputData[index + 2];
+    uint16 bID = cpu.inputData[index + 3];      // boid ID
 
     // Decode position and velocity
     Vector position = Vector(((int32_fp)((int32)pos >> 16)) >> 4,
@@ -915,63 +2456,93 @@ Boid parsePackedBoid(uint8 offset) {
     Vector velocity = Vector(((int32_fp)((int32)vel >> 16)) >> 4,
             ((int32_fp)((int16)vel)) >> 4);
 
-    std::cout << "-BoidCPU #" << boidCPUID << " received boid #" << bID <<
-            " from BoidCPU #" << inputData[CMD_FROM] << std::endl;
+    std::cout << "-BoidCPU #" << cpu.boidCPUID << " received boid #" << bID <<
+            " from BoidCPU #" << cpu.inputData[CMD_FROM] << std::endl;
 
     return Boid(bID, position, velocity);
 }
 
+/******************************************************************************/
+/*
+ * Packs and sends all the boids of this BoidCPU. See the version of this 
+ * function that takes a list of boid indexes for details. 
+ *
+ * @param   cpu         The BoidCPU state
+ * @param   to          The recipient of the message
+ * @param   msg_type    The type of message to send
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void packBoidsForSending(BoidCPUContext &cpu, uint32 to, uint32 msg_type) {
+    BoidIndex allBoids[MAX_BOIDS];
+
+    allBoidsLoop: for (int i = 0; i < cpu.boidCount; i++) {
+        allBoids[i] = i;
+    }
+
+    packBoidsForSending(cpu, to, msg_type, allBoids, cpu.boidCount);
+}
+
 /******************************************************************************/
 /*
  * Uses bitshifting to reduce the amount of data that is communicated. This is 
  * done by packing the boid data, which is currently 16 bits each, into the 32 
- * bit fields used when communicating over the AXI-bus. Splits the boids of a 
- * BoidCPU across multiple messages if they do not fit in one and can encode 
- * negative and fixed-point values. If the BoidCPU contains no boids, an empty 
- * message is sent so the recipient knows this. 
- * 
- * TODO: Currently sends all boids of a BoidCPU (for neighbour search and 
- * BoidGPU update), enhance to specify what boids to send (for boid transfer)
+ * bit fields used when communicating over the AXI-bus. Splits the boids across 
+ * multiple messages if they do not fit in one and can encode negative and 
+ * fixed-point values. If there are no boids to send, an empty message is sent 
+ * so the recipient knows this. 
+ *
+ * If ASYNC_TIME_STEPS is defined, the time step of this BoidCPU is appended to 
+ * the body of every message. The number of boids in a message is taken from 
+ * its length rounded down, so recipients that do not read the tag are not 
+ * affected by it.
  *
+ * @param   cpu         The BoidCPU state
  * @param   to          The recipient of the message
  * @param   msg_type    The type of message to send
+ * @param   boidIndexes The indexes in boids[] of the boids to send
+ * @param   count       The number of boids to send
  *
  * @return  None
  *
  ******************************************************************************/
-void packBoidsForSending(uint32 to, uint32 msg_type) {
-    if (boidCount > 0) {
+void packBoidsForSending(BoidCPUContext &cpu, uint32 to, uint32 msg_type,
+        BoidIndex *boidIndexes, BoidIndex count) {
+    if (count > 0) {
         // The first bit of the body is used to indicate the number of messages
         uint16 partialMaxCmdBodyLen = MAX_CMD_BODY_LEN - 1;
 
-        // First, calculate how many messages need to be sent
+        // First, calculate the number of boids that can be sent per message
+        uint16 boidsPerMsg = (uint16)(partialMaxCmdBodyLen / BOID_DATA_LENGTH);
+
+        // Then calculate how many messages need to be sent. Only whole boids 
+        // fit in a message, so count in whole messages' worth of boids.
         // Doing this division saves a DSP at the expense of about 100 LUTs
-        int16 numerator = boidCount * BOID_DATA_LENGTH;
+        int16 numerator = count;
         uint16 msgCount = 0;
         nbrMsgCountCalcLoop: for (msgCount = 0; numerator > 0; msgCount++) {
-            numerator -= partialMaxCmdBodyLen;
+            numerator -= boidsPerMsg;
         }
 
-        // Then calculate the number of boids that can be sent per message
-        uint16 boidsPerMsg = (uint16)(partialMaxCmdBodyLen / BOID_DATA_LENGTH);
-
         // Determine the initial boid indexes for this message
-        uint8 startBoidIndex = 0;
-        uint8 endBoidIndex   = startBoidIndex + boidsPerMsg;
+        BoidIndex startBoidIndex = 0;
+        BoidIndex endBoidIndex = startBoidIndex + boidsPerMsg;
 
         // Next, send a message for each group of boids
         nbrMsgSendLoop: for (uint16 i = 0; i < msgCount; i++) {
             // Limit the end index if the message won't be full
-            if (endBoidIndex > boidCount) {
-                endBoidIndex = boidCount;
+            if (endBoidIndex > count) {
+                endBoidIndex = count;
             }
 
             // Put the number of subsequent messages in the first body field
-            outputBody[0] = msgCount - i - 1;
+            cpu.outputBody[0] = msgCount - i - 1;
 
             // The next step is to create the message data
             uint8 index = 1;
-            NMClp: for (uint8 j = startBoidIndex; j < endBoidIndex; j++) {
+            NMClp: for (BoidIndex j = startBoidIndex; j < endBoidIndex; j++) {
+                Boid boid = cpu.boids[boidIndexes[j]];
                 uint32 position = 0;
                 uint32 velocity = 0;
 
@@ -989,36 +2560,40 @@ void packBoidsForSending(uint32 to, uint32 msg_type) {
                 // are there due to the 2s complement notation for negatives.
 
                 // Encode position
-                position |= ((uint32)(((int32_fp)(boids[j].position.x)) << 4) << 16);
+                position |= ((uint32)(((int32_fp)(boid.position.x)) << 4) << 16);
 
-                if (boids[j].position.y < 0) {
+                if (boid.position.y < 0) {
                     position |= ((~(((uint32)0xFFFF) << 16)) &
-                            ((uint32)((int32_fp)(boids[j].position.y) << 4)));
+                            ((uint32)((int32_fp)(boid.position.y) << 4)));
                 } else {
-                    position |= ((uint32)((int32_fp)(boids[j].position.y) << 4));
+                    position |= ((uint32)((int32_fp)(boid.position.y) << 4));
                 }
 
                 // Encode velocity
-                velocity |= ((uint32)(((int32_fp)(boids[j].velocity.x)) << 4) << 16);
+                velocity |= ((uint32)(((int32_fp)(boid.velocity.x)) << 4) << 16);
 
-                if (boids[j].velocity.y < 0) {
+                if (boid.velocity.y < 0) {
                     velocity |= ((~(((uint32)0xFFFF) << 16)) &
-                            ((uint32)((int32_fp)(boids[j].velocity.y) << 4)));
+                            ((uint32)((int32_fp)(boid.velocity.y) << 4)));
                 } else {
-                    velocity |= ((uint32)((int32_fp)(boids[j].velocity.y) << 4));
+                    velocity |= ((uint32)((int32_fp)(boid.velocity.y) << 4));
                 }
 
-                outputBody[index + 0] = position;
-                outputBody[index + 1] = velocity;
+                cpu.outputBody[index + 0] = position;
+                cpu.outputBody[index + 1] = velocity;
                 // ID can be removed on deployment
-                outputBody[index + 2] = boids[j].id;
+                cpu.outputBody[index + 2] = boid.id;
 
                 index += BOID_DATA_LENGTH;
             }
 
             // Finally send the message
             uint32 dataLength = (((endBoidIndex - startBoidIndex)) * BOID_DATA_LENGTH) + 1;
-            generateOutput(dataLength, to, msg_type, outputBody);
+#ifdef ASYNC_TIME_STEPS
+            cpu.outputBody[dataLength] = cpu.timeStep;
+            dataLength++;
+#endif
+            generateOutput(cpu, dataLength, to, msg_type, cpu.outputBody);
 
             // Update the boid indexes for the next message
             startBoidIndex += boidsPerMsg;
@@ -1026,8 +2601,13 @@ void packBoidsForSending(uint32 to, uint32 msg_type) {
         }
     } else {
         std::cout << "No boids to send, sending empty message" << std::endl;
-        outputBody[0] = 0;
-        generateOutput(1, to, msg_type, outputBody);
+        uint32 dataLength = 1;
+        cpu.outputBody[0] = 0;
+#ifdef ASYNC_TIME_STEPS
+        cpu.outputBody[dataLength] = cpu.timeStep;
+        dataLength++;
+#endif
+        generateOutput(cpu, dataLength, to, msg_type, cpu.outputBody);
     }
 }
 
@@ -1039,6 +2619,11 @@ void packBoidsForSending(uint32 to, uint32 msg_type) {
  * access to the input and output ports. If the output queue is full, the 
  * new data is not added.
  *
+ * If STREAMING_OUTPUT is defined, the message is instead written straight to 
+ * the output port bound by toplevel(). There is no queue to fill, so no 
+ * message is dropped, and writing blocks while the output port is full.
+ *
+ * @param   cpu     The BoidCPU state
  * @param   len     The length of the message body
  * @param   to      The recipient of the message
  * @param   type    The type of the message (defined in boidCPU.h)
@@ -1047,23 +2632,42 @@ void packBoidsForSending(uint32 to, uint32 msg_type) {
  * @return  None
  *
  ******************************************************************************/
-void generateOutput(uint32 len, uint32 to, uint32 type, uint32 *data) {
-    if (outputCount > MAX_OUTPUT_CMDS - 1) {
+void generateOutput(BoidCPUContext &cpu, uint32 len, uint32 to, uint32 type,
+        uint32 *data) {
+#ifdef STREAMING_OUTPUT
+    uint32 header[CMD_HEADER_LEN];
+    header[CMD_LEN]  = len + CMD_HEADER_LEN;
+    header[CMD_TO]   = to;
+    header[CMD_FROM] = cpu.boidCPUID;
+    header[CMD_TYPE] = type;
+
+    streamHeaderLoop: for (int i = 0; i < CMD_HEADER_LEN; i++) {
+        cpu.outputStream->write(header[i]);
+    }
+
+    streamBodyLoop: for (int i = 0; i < len; i++) {
+        cpu.outputStream->write(data[i]);
+    }
+
+    printCommand(cpu, true, header, data);
+#else
+    if (cpu.outputCount > MAX_OUTPUT_CMDS - 1) {
         std::cout << "Cannot send message, output buffer is full (" <<
-                outputCount << "/" << MAX_OUTPUT_CMDS << ")" << std::endl;
+                cpu.outputCount << "/" << MAX_OUTPUT_CMDS << ")" << std::endl;
     } else {
-        outputData[outputCount][CMD_LEN]  = len + CMD_HEADER_LEN;
-        outputData[outputCount][CMD_TO]   = to;
-        outputData[outputCount][CMD_FROM] = boidCPUID;
-        outputData[outputCount][CMD_TYPE] = type;
+        cpu.outputData[cpu.outputCount][CMD_LEN]  = len + CMD_HEADER_LEN;
+        cpu.outputData[cpu.outputCount][CMD_TO]   = to;
+        cpu.outputData[cpu.outputCount][CMD_FROM] = cpu.boidCPUID;
+        cpu.outputData[cpu.outputCount][CMD_TYPE] = type;
 
         if (len > 0) {
             createOutputCommandLoop: for (int i = 0; i < len; i++) {
-                outputData[outputCount][CMD_HEADER_LEN + i] = data[i];
+                cpu.outputData[cpu.outputCount][CMD_HEADER_LEN + i] = data[i];
             }
         }
-        outputCount++;
+        cpu.outputCount++;
     }
+#endif
 }
 
 /******************************************************************************/
@@ -1074,17 +2678,17 @@ void generateOutput(uint32 len, uint32 to, uint32 type, uint32 *data) {
  *
  * TODO: Would it be better to return as soon as true is set?
  *
- * @param   None
+ * @param   cpu     The BoidCPU state
  *
  * @return          True if the message was from a neighbour, false otherwise
  *
  ******************************************************************************/
-bool fromNeighbour() {
+bool fromNeighbour(BoidCPUContext &cpu) {
     bool result = false;
 
-    if (neighbouringBoidCPUsSetup) {
+    if (cpu.neighbouringBoidCPUsSetup) {
         fromNbrCheck: for (int i = 0; i < MAX_BOIDCPU_NEIGHBOURS; i++) {
-            if (inputData[CMD_FROM] == neighbouringBoidCPUs[i]) {
+            if (cpu.inputData[CMD_FROM] == cpu.neighbouringBoidCPUs[i]) {
                 result = true;
             }
         }
@@ -1097,33 +2701,36 @@ bool fromNeighbour() {
 /*
  * Parses a message and prints it out to the standard output.
  *
+ * @param   cpu     The BoidCPU state
  * @param   send    True if the message is being sent, false otherwise
- * @param   data    The array containing the message
+ * @param   header  The array containing the message header
+ * @param   body    The array containing the message body
  *
  * @return  None
  *
  ******************************************************************************/
- void printCommand(bool send, uint32 *data) {
+ void printCommand(BoidCPUContext &cpu, bool send, uint32 *header,
+        uint32 *body) {
     if (send) {
-        if (data[CMD_TO] == CONTROLLER_ID) {
-            std::cout << "-> TX, BoidCPU #" << boidCPUID << " sent command to controller: ";
-        } else if (data[CMD_TO] == BOIDGPU_ID) {
-            std::cout << "-> TX, BoidCPU #" << boidCPUID << " sent command to BoidGPU: ";
+        if (header[CMD_TO] == CONTROLLER_ID) {
+            std::cout << "-> TX, BoidCPU #" << cpu.boidCPUID << " sent command to controller: ";
+        } else if (header[CMD_TO] == BOIDGPU_ID) {
+            std::cout << "-> TX, BoidCPU #" << cpu.boidCPUID << " sent command to BoidGPU: ";
         } else {
-            std::cout << "-> TX, BoidCPU #" << boidCPUID << " sent command to " << data[CMD_TO] << ": ";
+            std::cout << "-> TX, BoidCPU #" << cpu.boidCPUID << " sent command to " << header[CMD_TO] << ": ";
         }
     } else {
-        if (data[CMD_FROM] == CONTROLLER_ID) {
-            std::cout << "<- RX, BoidCPU #" << boidCPUID << " received command from controller: ";
-        } else if (data[CMD_FROM] == BOIDGPU_ID) {
+        if (header[CMD_FROM] == CONTROLLER_ID) {
+            std::cout << "<- RX, BoidCPU #" << cpu.boidCPUID << " received command from controller: ";
+        } else if (header[CMD_FROM] == BOIDGPU_ID) {
             // This should never happen
-            std::cout << "<- RX, BoidCPU #" << boidCPUID << " received command from BoidGPU: ";
+            std::cout << "<- RX, BoidCPU #" << cpu.boidCPUID << " received command from BoidGPU: ";
         }  else {
-            std::cout << "<- RX, BoidCPU #" << boidCPUID << " received command from " << data[CMD_FROM] << ": ";
+            std::cout << "<- RX, BoidCPU #" << cpu.boidCPUID << " received command from " << header[CMD_FROM] << ": ";
         }
     }
 
-    switch (data[CMD_TYPE]) {
+    switch (header[CMD_TYPE]) {
     case 0:
         std::cout << "do something";
         break;
@@ -1169,6 +2776,9 @@ bool fromNeighbour() {
     case CMD_BOID:
         std::cout << "boid in transit";
         break;
+    case CMD_BOID_BATCH:
+        std::cout << "boids in transit";
+        break;
     case MODE_DRAW:
         std::cout << "send boids to BoidGPU";
         break;
@@ -1189,13 +2799,13 @@ bool fromNeighbour() {
 
     std::cout << "\t";
     printCommandLoop: for (int i = 0; i < CMD_HEADER_LEN; i++) {
-        std::cout << data[i] << " ";
+        std::cout << header[i] << " ";
     }
 
     std::cout << "|| ";
 
-    printCmdDataLoop: for (int i = 0; i < data[CMD_LEN] - CMD_HEADER_LEN; i++) {
-        std::cout << data[CMD_HEADER_LEN + i] << " ";
+    printCmdDataLoop: for (int i = 0; i < header[CMD_LEN] - CMD_HEADER_LEN; i++) {
+        std::cout << body[i] << " ";
     }
     std::cout << std::endl;
 }
@@ -1223,7 +2833,7 @@ Boid::Boid() {
     position = Vector(0, 0);
     velocity = Vector(0, 0);
 
-    boidNeighbourIndex = 0;
+    boidNeighbours = NULL;
     boidNeighbourCount = 0;
 }
 
@@ -1243,7 +2853,7 @@ Boid::Boid(uint16 _boidID, Vector initPosition, Vector initVelocity) {
     position = initPosition;
     velocity = initVelocity;
 
-    boidNeighbourIndex = 0;
+    boidNeighbours = NULL;
     boidNeighbourCount = 0;
 
     std::cout << "Created boid #" << id << std::endl;
@@ -1257,6 +2867,10 @@ Boid::Boid(uint16 _boidID, Vector initPosition, Vector initVelocity) {
  * 
  * The actual implementation used is based examples in 'The Nature of Code' by 
  * Daniel Shiffman: http://natureofcode.com/book/chapter-6-autonomous-agents/
+ * 
+ * The behaviours are calculated by the single pass flock() kernel. When using 
+ * the test bench, the result is checked against the separate(), align() and 
+ * cohesion() implementation, which must match exactly.
  *
  * @param   None
  *
@@ -1264,28 +2878,119 @@ Boid::Boid(uint16 _boidID, Vector initPosition, Vector initVelocity) {
  *
  ******************************************************************************/
 void Boid::update(void) {
+    updateInto(this);
+}
+
+/******************************************************************************/
+/*
+ * Calculates the new position and velocity of the current boid, as update() 
+ * does, but writes them (and the boid's ID) to next. The current boid and its 
+ * neighbours are only read, so next can be in another state buffer.
+ *
+ * @param   next    The boid to write the new state to, which may be this boid
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void Boid::updateInto(Boid *next) {
     std::cout << "Updating boid #" << id << std::endl;
 
+    Vector nextVelocity = velocity;
+
     if (boidNeighbourCount > 0) {
-        acceleration.add(separate());
-        acceleration.add(align());
-        acceleration.add(cohesion());
-    }
+        Vector steer = flock();
+
+#ifdef USING_TESTBENCH
+        Vector reference;
+        reference.add(separate());
+        reference.add(align());
+        reference.add(cohesion());
+
+        if ((steer.x != reference.x) || (steer.y != reference.y)) {
+            std::cout << "Flocking mismatch for boid #" << id << ": [" <<
+                    steer.x << " " << steer.y << "] != [" << reference.x <<
+                    " " << reference.y << "]" << std::endl;
+            flockMismatchCount++;
+        }
+#endif
 
-    velocity.add(acceleration);
+        nextVelocity.add(steer);
+    }
 
 #ifdef REDUCED_LUT_USAGE
-    int32_fp mag = velocity.mag();
+    int32_fp mag = nextVelocity.mag();
     if (mag > MAX_VELOCITY) {
-        velocity.setMag(MAX_VELOCITY);
+        nextVelocity.setMag(MAX_VELOCITY);
     }
 #else
-    velocity.limit(MAX_VELOCITY);
+    nextVelocity.limit(MAX_VELOCITY);
 #endif
 
-    position.add(velocity);
-    acceleration.mul(0);
-    printBoidInfo();
+    next->position = position;
+    next->position.add(nextVelocity);
+    next->velocity = nextVelocity;
+    next->id = id;
+    next->printBoidInfo();
+}
+
+/******************************************************************************/
+/*
+ * Calculates the combined separation, alignment and cohesion steering vectors 
+ * of the current boid in a single traversal of its neighbours. The position, 
+ * velocity and separation sums are gathered together and then each steering 
+ * vector is derived exactly as in separate(), align() and cohesion(), so that 
+ * the result is identical to calling them in turn.
+ *
+ * @param   None
+ *
+ * @return          The sum of the separation, alignment and cohesion vectors
+ *
+ ******************************************************************************/
+Vector Boid::flock(void) {
+    Vector positionTotal;
+    Vector velocityTotal;
+    Vector separationTotal;
+    Vector diff;
+
+    flockBoidsLoop: for (int i = 0; i < boidNeighbourCount; i++) {
+        Boid *neighbour = boidNeighbours[i];
+
+        diff = Vector::sub(position, neighbour->position);
+        diff.normalise();
+        separationTotal.add(diff);
+
+        velocityTotal.add(neighbour->velocity);
+        positionTotal.add(neighbour->position);
+    }
+
+    // Separation
+    separationTotal.div(boidNeighbourCount);
+    separationTotal.setMag(MAX_VELOCITY);
+    Vector separation = Vector::sub(separationTotal, velocity);
+
+    // Alignment
+    velocityTotal.div(boidNeighbourCount);
+    velocityTotal.setMag(MAX_VELOCITY);
+    Vector alignment = Vector::sub(velocityTotal, velocity);
+
+    // Cohesion
+    positionTotal.div(boidNeighbourCount);
+    Vector desired = Vector::sub(positionTotal, position);
+    desired.setMag(MAX_VELOCITY);
+    Vector cohesion = Vector::sub(desired, velocity);
+
+#ifndef REDUCED_LUT_USAGE
+    separation.limit(MAX_FORCE);
+    alignment.limit(MAX_FORCE);
+    cohesion.limit(MAX_FORCE);
+#endif
+
+    Vector steer;
+    steer.add(separation);
+    steer.add(alignment);
+    steer.add(cohesion);
+
+    return steer;
 }
 
 /******************************************************************************/
@@ -1309,7 +3014,7 @@ Vector Boid::align(void) {
     Vector total;
 
     alignBoidsLoop: for (int i = 0; i < boidNeighbourCount; i++) {
-        total.add(boidNeighbourList[boidNeighbourIndex][i]->velocity);
+        total.add(boidNeighbours[i]->velocity);
     }
 
     total.div(boidNeighbourCount);
@@ -1345,7 +3050,7 @@ Vector Boid::separate(void) {
     Vector diff;
 
     separateBoidsLoop: for (int i = 0; i < boidNeighbourCount; i++) {
-        diff = Vector::sub(position, boidNeighbourList[boidNeighbourIndex][i]->position);
+        diff = Vector::sub(position, boidNeighbours[i]->position);
         diff.normalise();
         total.add(diff);
     }
@@ -1382,7 +3087,7 @@ Vector Boid::cohesion(void) {
     Vector total;
 
     coheseBoidLoop: for (int i = 0; i < boidNeighbourCount; i++) {
-        total.add(boidNeighbourList[boidNeighbourIndex][i]->position);
+        total.add(boidNeighbours[i]->position);
     }
 
     total.div(boidNeighbourCount);
@@ -1403,23 +3108,37 @@ Vector Boid::cohesion(void) {
  * 
  * It was not possible for a Boid instance to contain a list of its neighbours. 
  * Therefore, each BoidCPU contains a list of neighbours for each boid it 
- * contains. Each boid needs to know at what index its neighbours are held in 
- * this structure and how many neighbours it has (to avoid reading beyond the 
- * edge of the arrary). This method is used to supply the current boid with 
- * that information. 
+ * contains. Each boid needs to know where its neighbours are held in this 
+ * structure and how many neighbours it has (to avoid reading beyond the edge 
+ * of the arrary). This method is used to supply the current boid with that 
+ * information. 
  *
- * @param   neighbourIndex  The index of the current boid's neighbours in the 
- *                          parent BoiCPU's neighbour data structure
+ * @param   neighbours      The current boid's list of neighbours in the 
+ *                          parent BoidCPU's neighbour data structure
  * @param   neighbourCount  The number of neighbours the current boid has
  *
  * @return  None
  *
  ******************************************************************************/
-void Boid::setNeighbourDetails(uint8 neighbourIndex, uint8 neighbourCount) {
-    boidNeighbourIndex = neighbourIndex;
+void Boid::setNeighbourDetails(Boid **neighbours, uint8 neighbourCount) {
+    boidNeighbours = neighbours;
     boidNeighbourCount = neighbourCount;
 }
 
+/******************************************************************************/
+/*
+ * Returns the number of neighbours the current boid has, as last supplied by 
+ * setNeighbourDetails().
+ *
+ * @param   None
+ *
+ * @return  The number of neighbours the current boid has
+ *
+ ******************************************************************************/
+uint8 Boid::getNeighbourCount() {
+    return boidNeighbourCount;
+}
+
 /******************************************************************************/
 /*
  * Print out the state of the current boid to standard output. Used during 
@@ -1600,7 +3319,10 @@ void Vector::limit(int16_fp max) {
 /******************************************************************************/
 /*
  * Normalises the current vector. This creates a unit vector (length of 1) that  
- * has the same direction as the original vector. 
+ * has the same direction as the original vector. The method used is selected 
+ * at compile time by NORMALISE_STRATEGY, trading precision for logic/speed. 
+ * The error of each method against the exact one is reported by the BoidCPU 
+ * test bench.
  *
  * @TODO    If the vector is of length 0, leave the vector unchanged
  * 
@@ -1610,6 +3332,26 @@ void Vector::limit(int16_fp max) {
  *
  ******************************************************************************/
 void Vector::normalise() {
+#if NORMALISE_STRATEGY == NORMALISE_FAST_INV_SQRT
+    normaliseFastInvSqrt();
+#elif NORMALISE_STRATEGY == NORMALISE_LUT
+    normaliseLUT();
+#else
+    normaliseExact();
+#endif
+}
+
+/******************************************************************************/
+/*
+ * Normalises the current vector by dividing each component by the magnitude, 
+ * which uses a square root and two divides. 
+ *
+ * @param   None
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void Vector::normaliseExact() {
     int16_fp magnitude = mag();
 
     if (magnitude != 0) {
@@ -1619,3 +3361,125 @@ void Vector::normalise() {
         y = 0;
     }
 }
+
+/******************************************************************************/
+/*
+ * Normalises the current vector by multiplying each component by the 
+ * reciprocal square root of the squared magnitude. The reciprocal square root 
+ * is seeded with a linear approximation and refined with one Newton-Raphson 
+ * step, r = r * (1.5 - 0.5 * s * r^2), avoiding both the square root and the 
+ * divides. 
+ *
+ * @param   None
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void Vector::normaliseFastInvSqrt() {
+    int32_fp squaredMag = (x*x + y*y);
+
+    if (squaredMag != 0) {
+        int32_fp mantissa;
+        int8 exponent;
+        recip_fp seed = invSqrtSeed(squaredMag, &mantissa, &exponent);
+
+        // Seed with the line through 1/sqrt(m) at m = 1 and m = 2
+        recip_fp estimate = (recip_fp)1.29289322 - (recip_fp)0.29289322 * mantissa;
+        estimate = estimate * seed;
+
+        // One Newton-Raphson step
+        recip_fp product = squaredMag * estimate * estimate;
+        recip_fp reciprocal = estimate * ((recip_fp)1.5 - (product >> 1));
+
+        x = x * reciprocal;
+        y = y * reciprocal;
+    } else {
+        x = 0;
+        y = 0;
+    }
+}
+
+/******************************************************************************/
+/*
+ * Normalises the current vector by multiplying each component by a reciprocal 
+ * square root of the squared magnitude taken from a look-up table. The table 
+ * covers mantissas in [1, 2) and is indexed by the top fractional bits of the 
+ * mantissa, without any refinement. 
+ *
+ * @param   None
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void Vector::normaliseLUT() {
+    int32_fp squaredMag = (x*x + y*y);
+
+    if (squaredMag != 0) {
+        int32_fp mantissa;
+        int8 exponent;
+        recip_fp seed = invSqrtSeed(squaredMag, &mantissa, &exponent);
+
+        int32_fp scaled = (mantissa - 1) * NORMALISE_LUT_SIZE;
+        uint8 index = scaled.to_int();
+        recip_fp reciprocal = invSqrtTable[index] * seed;
+
+        x = x * reciprocal;
+        y = y * reciprocal;
+    } else {
+        x = 0;
+        y = 0;
+    }
+}
+
+/******************************************************************************/
+/*
+ * Splits the supplied (non-zero) squared magnitude s into a mantissa m in 
+ * [1, 2) and an exponent k, where s = m * 2^k, and returns 2^(-k/2). The 
+ * reciprocal square root of s is then this value multiplied by 1/sqrt(m). 
+ * Fixed iteration counts are used so that the loops can be unrolled.
+ *
+ * @param   s           The squared magnitude to split
+ * @param   mantissa    Set to the mantissa, m
+ * @param   exponent    Set to the exponent, k
+ *
+ * @return              The reciprocal square root of 2^k
+ *
+ ******************************************************************************/
+recip_fp Vector::invSqrtSeed(int32_fp s, int32_fp *mantissa, int8 *exponent) {
+    int32_fp m = s;
+    int8 k = 0;
+
+    // An int32_fp has 23 integer and 8 fractional magnitude bits
+    seedDownLoop: for (int i = 0; i < 23; i++) {
+        if (m >= 2) {
+            m = m >> 1;
+            k++;
+        }
+    }
+
+    seedUpLoop: for (int i = 0; i < 8; i++) {
+        if (m < 1) {
+            m = m << 1;
+            k--;
+        }
+    }
+
+    // 2^(-k/2) = 2^(-floor(k/2)), times 1/sqrt(2) if k is odd
+    int8 halfK = k >> 1;
+    recip_fp result = 1;
+
+    if (k & 1) {
+        result = (recip_fp)0.70710678;
+    }
+
+    if (halfK >= 0) {
+        result = result >> halfK;
+    } else {
+        result = result << -halfK;
+    }
+
+    *mantissa = m;
+    *exponent = k;
+
+    return result;
+}
@@ -13,7 +13,8 @@
  * in boidCPU.cpp to aid readability of the source code. The #defines in 
  * this file are supposed to be identical to those in boidMaster.h and boids.h. 
  * Ideally, there would be no duplication, but the tools used did not support a 
- * common file. 
+ * common file. The command definitions have since been moved to 
+ * boidCommands.h, which the cores and the host runtime share. 
  * 
  * This FPGA core was developed using the 2013.4 version Xilinx’s Vivado High 
  * Level Synthesis (HLS) Design Suite and deployed to multiple Xilinx Spartan-6 
@@ -29,71 +30,63 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <iostream>                 // For cout
+#include <assert.h>                 // For assert()
 #include <ap_int.h>                 // For arbitrary precision types
 #include <ap_fixed.h>               // For fixed point data types
 #include <hls_stream.h>
 #include "hls_math.h"               // For square root (sqrt())
+#include "boidCommands.h"           // The command definitions
 
 /**************************** Constant Definitions ****************************/
 
 // Command definitions ---------------------------------------------------------
-#define CMD_HEADER_LEN          4   // The length of the command header
-#define MAX_CMD_BODY_LEN        30  // The max length of the command body
-#define MAX_CMD_LEN             CMD_HEADER_LEN + MAX_CMD_BODY_LEN
-
-#define MAX_OUTPUT_CMDS         12  // The number of output commands to buffer
+// The commands are defined in boidCommands.h
 #define MAX_INPUT_CMDS          1   // The number of input commands to buffer
 
-#define CMD_LEN                 0   // The index of the command length
-#define CMD_TO                  1   // The index of the command target
-#define CMD_FROM                2   // The index of the command sender
-#define CMD_TYPE                3   // The index of the command type
-
-#define CMD_BROADCAST           0   // The number for a broadcast command
-#define CONTROLLER_ID           1   // The ID of the controller
-#define BOIDGPU_ID              2   // The ID of the BoidGPU
-#define FIRST_BOIDCPU_ID        3   // The lowest possible BoidCPU ID
-#define CMD_MULTICAST           99  // The 'to' value for multicast commands
-
-#define BOID_DATA_LENGTH        3   // The number of bits to send for a boid
-
-#define MODE_INIT               1   // Controller -> BoidCPU (Broadcast (B))
-#define CMD_PING                2   // Controller -> BoidCPU (B)
-#define CMD_PING_REPLY          3   // BoidCPU -> Controller (Direct (D))
-#define CMD_USER_INFO           4   // Controller -> BoidGPU (D)
-#define CMD_SIM_SETUP           5   // Controller -> Boid[CG]PU (D)
-#define MODE_CALC_NBRS          6   // Controller -> BoidCPU (B)
-#define CMD_PING_END            7   // Gatekeeper -> Controller (D)
-#define CMD_NBR_REPLY           8   // BoidCPU -> BoidCPU (D)
-#define MODE_POS_BOIDS          9   // Controller -> BoidCPU (B)
-#define MODE_LOAD_BAL           10  // Controller -> BoidCPU (?)
-#define MODE_TRAN_BOIDS         11  // Controller -> BoidCPU (B)
-#define CMD_BOID                12  // BoidCPU -> BoidCPU (D)
-#define MODE_DRAW               14  // Controller -> BoidCPU (B)
-#define CMD_DRAW_INFO           15  // BoidCPU -> BoidGPU (D)
-#define CMD_KILL                16  // Controller -> All (B)
-#define CMD_ACK                 17
-#define CMD_PING_START          18
-#define CMD_LOAD_BAL_REQUEST    19
-#define CMD_LOAD_BAL            20
-#define CMD_BOUNDS_AT_MIN       21
-#define CMD_DEBUG               76
-
-#define CMD_SETUP_BNBRS_IDX     7   // Neighbouring BoidCPU start index
-#define CMD_SETUP_COORD_IDX     2   // Coordinates start index
-#define CMD_SETUP_NBCNT_IDX     6   // Distinct BoidCPU neighbour index
-#define CMD_SETUP_NEWID_IDX     0   // New BoidCPU ID index
-#define CMD_SETUP_BDCNT_IDX     1   // Initial boid count index
-#define CMD_SETUP_SIMWH_IDX     15  // The simulation width/height start index
-
 // Boid definitions ------------------------------------------------------------
-#define MAX_BOIDS               40  // The maximum number of boids for a BoidCPU
 #define MAX_VELOCITY            5
 #define MAX_FORCE               1   // Determines how quickly a boid can turn
-#define VISION_RADIUS           90  // How far a boid can see
-#define VISION_RADIUS_SQUARED   8100
 #define SEP_RAIDUS_SQUARED      2025
-#define MAX_NEIGHBOURING_BOIDS  65  // TODO: Decide on appropriate value?
+
+// Capacity definitions (set by BOIDCPU_CAPACITY, see Type Definitions) --------
+#ifndef BOIDCPU_CAPACITY
+#define BOIDCPU_CAPACITY        FPGACapacity    // The BoidCPU capacity traits
+#endif
+
+#define MAX_BOIDS               (BOIDCPU_CAPACITY::maxBoids)
+#define MAX_NEIGHBOURING_BOIDS  (BOIDCPU_CAPACITY::maxNeighbouringBoids)
+#define MAX_BOID_NEIGHBOURS     (BOIDCPU_CAPACITY::maxBoidNeighbours)
+#define MAX_QUEUED_BOIDS        (BOIDCPU_CAPACITY::maxQueuedBoids)
+#define MAX_OUTPUT_CMDS         (BOIDCPU_CAPACITY::maxOutputCmds)
+#define VISION_RADIUS           (BOIDCPU_CAPACITY::visionRadius)
+#define VISION_RADIUS_SQUARED   (BOIDCPU_CAPACITY::visionRadiusSquared)
+
+// Spatial grid definitions (used when SPATIAL_GRID_ENABLED is defined) --------
+#define GRID_CELL_SIZE          NBR_SEARCH_RADIUS   // Width/height of a cell
+#define MAX_GRID_COLS           18  // The max grid columns, including the halo
+#define MAX_GRID_ROWS           12  // The max grid rows, including the halo
+#define MAX_GRID_CELLS          (MAX_GRID_COLS * MAX_GRID_ROWS)
+
+// Structure-of-arrays definitions (used when SOA_NBR_SEARCH is defined) -------
+#define SOA_LANES               16  // The widest SIMD vector, in 16-bit lanes
+#define SOA_FRACTIONAL_BITS     4   // The fractional bits of an int16_fp
+#define MAX_SOA_BOIDS           (((MAX_NEIGHBOURING_BOIDS + SOA_LANES - 1) / \
+                                        SOA_LANES) * SOA_LANES)
+#define SOA_MASK_WORDS          ((MAX_SOA_BOIDS + 31) / 32)
+
+// Vector normalisation strategies (selected by NORMALISE_STRATEGY) ------------
+#define NORMALISE_EXACT         0   // Square root and two divides
+#define NORMALISE_FAST_INV_SQRT 1   // Reciprocal square root, one Newton step
+#define NORMALISE_LUT           2   // Reciprocal square root look-up table
+#define NORMALISE_LUT_SIZE      32  // The number of entries in the LUT
+
+// Neighbour list caching definitions (used when NBR_LIST_CACHING is defined) --
+// A cached list is reused until a boid has moved half of the skin, which at
+// MAX_VELOCITY takes four time steps. While a list is reused, the exchanged
+// boids are ignored and those of other BoidCPUs are extrapolated from their
+// last known velocity, so the results only approximate a full search.
+#define NBR_LIST_SKIN           (8 * MAX_VELOCITY)  // Extra radius of a list
+#define NBR_LIST_MAX_REUSE      8   // The max steps a cached list is used for
 
 // #define ALIGNMENT_WEIGHT        1
 // #define SEPARATION_WEIGHT       1
@@ -102,7 +95,6 @@
 // BoidCPU definitions ---------------------------------------------------------
 #define EDGE_COUNT              4   // The number of edges a BoidCPU has
 #define MAX_BOIDCPU_NEIGHBOURS  8   // The maximum neighbours a BoidCPUs has
-#define MAX_QUEUED_BOIDS        20  // The maximum queued boids that can be held
 
 #define BOID_THRESHOLD          30  // The number of boids to overload a BoidCPU
 
@@ -149,6 +141,36 @@ typedef ap_fixed<16, 12, AP_TRN, AP_SAT> int16_fp;
 // 32-bit signed word with 8 fractional bits, truncation and saturation
 typedef ap_fixed<32, 24, AP_TRN, AP_SAT> int32_fp;
 
+// 32-bit signed word with 24 fractional bits, used for reciprocals
+typedef ap_fixed<32, 8, AP_TRN, AP_SAT> recip_fp;
+
+// The capacities of a BoidCPU. The BoidCPU state is sized from the traits 
+// selected by BOIDCPU_CAPACITY, so different capacities can be built from the 
+// same source. A boid's own neighbour list is capped at MaxBoidNeighbours, 
+// which must fit in a uint8, and boid indexes are held as BoidIndex values.
+template<int MaxBoids, int MaxNeighbouringBoids, int MaxBoidNeighbours,
+        int MaxQueuedBoids, int MaxOutputCmds, int VisionRadius,
+        typename Index>
+struct BoidCPUCapacity {
+    static const int maxBoids = MaxBoids;
+    static const int maxNeighbouringBoids = MaxNeighbouringBoids;
+    static const int maxBoidNeighbours = MaxBoidNeighbours;
+    static const int maxQueuedBoids = MaxQueuedBoids;
+    static const int maxOutputCmds = MaxOutputCmds;
+    static const int visionRadius = VisionRadius;
+    static const int visionRadiusSquared = VisionRadius * VisionRadius;
+
+    typedef Index BoidIndex;
+};
+
+// The FPGA BoidCPU, 40 boids and 65 possible neighbours
+typedef BoidCPUCapacity<40, 65, 65, 20, 12, 90, uint8> FPGACapacity;
+
+// A host BoidCPU (see host/), 4096 boids and 4 BoidCPUs' worth of neighbours
+typedef BoidCPUCapacity<4096, 16384, 128, 2048, 8192, 90, uint16> HostCapacity;
+
+typedef BOIDCPU_CAPACITY::BoidIndex BoidIndex;
+
 /**************************** Function Prototypes *****************************/
 
 void toplevel(hls::stream<uint32> &input, hls::stream<uint32> &output);
@@ -170,6 +192,9 @@ class Vector {
     int16_fp mag();
     void setMag(int16_fp mag);
     void normalise();
+    void normaliseExact();
+    void normaliseFastInvSqrt();
+    void normaliseLUT();
 
 #ifndef REDUCED_BOID_BEHAVIOUR
     void limit(int16_fp max);
@@ -177,6 +202,9 @@ class Vector {
 
     static Vector sub(Vector v1, Vector v2);
     static int32_fp squaredDistanceBetween(Vector v1, Vector v2);
+
+ private:
+    static recip_fp invSqrtSeed(int32_fp s, int32_fp *mantissa, int8 *exponent);
 };
 
 class Boid {
@@ -189,22 +217,23 @@ class Boid {
     Boid(uint16 _boidID, Vector initPosition, Vector initVelocity);
 
     void update();              // Calculate the boid's new position
+    void updateInto(Boid *next);    // As update(), but write the result to next
     void draw();                // Draw the boid (send to BoidGPU)
 
     void printBoidInfo();
 
     // Tell the boid where its neighbours are located in the neighbouring boid
     // list held by the BoidCPU and how many there are
-    void setNeighbourDetails(uint8 index, uint8 count);
+    void setNeighbourDetails(Boid **neighbours, uint8 count);
+    uint8 getNeighbourCount();
 
  private:
-    Vector acceleration;
-
     // Points to this boid's list of neighbouring boids in the list of boid
     // neighbouring boids that is stored by the boid's BoidCPU
-    uint8 boidNeighbourIndex;
+    Boid **boidNeighbours;
     uint8 boidNeighbourCount;
 
+    Vector flock();             // Calculate all three forces in one pass
     Vector align();             // Calculate the alignment force
     Vector separate();          // Calculate the separation force
     Vector cohesion();          // Calculate the cohesion force
@@ -22,6 +22,7 @@
 
 /******************************* Include Files ********************************/
 
+#include <math.h>                   // For fabs()
 #include "boidCPU.h"
 
 /**************************** Variable Definitions ****************************/
@@ -41,6 +42,10 @@ uint32 tbNeighbours[MAX_BOIDCPU_NEIGHBOURS];
 
 bool drawBoids = false;
 
+// Set by the BoidCPU when its fused flocking kernel does not match the 
+// three-pass implementation
+extern uint32 flockMismatchCount;
+
 /**************************** Function Prototypes *****************************/
 
 void testSimulationSetup();
@@ -57,6 +62,8 @@ void simulateBoidTransfer();
 void processNeighbourReply();
 void processDrawInfo();
 
+void reportNormaliseError();
+
 void tbPrintCommand(bool send, uint32 *data);
 void tbCreateCommand(uint32 len, uint32 to, uint32 from, uint32 type, uint32 *data);
 
@@ -147,6 +154,15 @@ int main() {
 
     std::cout << "=====TestBench finished receiving=====" << std::endl;
 
+    reportNormaliseError();
+
+    // Check the fused flocking kernel matched the three-pass implementation
+    if (flockMismatchCount > 0) {
+        std::cout << "FAILED: " << flockMismatchCount << " flocking mismatches"
+                << std::endl;
+        return 1;
+    }
+
     return 0;   // A non-zero return value signals an error
 }
 
@@ -685,6 +701,60 @@ void processDrawInfo() {
     }
 }
 
+/******************************************************************************/
+/*
+ * Reports the error of the approximate Vector normalisation methods against 
+ * the exact method, so that a method can be chosen for a deployment using 
+ * NORMALISE_STRATEGY. Every vector with components in [-96, 96] at a step of 
+ * 0.5 is normalised, which covers the separation vectors between neighbours. 
+ * Errors are given in units of the int16_fp least significant bit (1/16).
+ *
+ * @param   None
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void reportNormaliseError() {
+    const char *names[2] = {"Fast inverse sqrt", "Look-up table"};
+    double maxError[2] = {0, 0};
+    double totalError[2] = {0, 0};
+    uint32 mismatches[2] = {0, 0};
+    uint32 vectorCount = 0;
+
+    for (double x = -96; x <= 96; x += 0.5) {
+        for (double y = -96; y <= 96; y += 0.5) {
+            if ((x == 0) && (y == 0)) continue;
+
+            Vector exact = Vector(x, y);
+            Vector approx[2] = {Vector(x, y), Vector(x, y)};
+
+            exact.normaliseExact();
+            approx[0].normaliseFastInvSqrt();
+            approx[1].normaliseLUT();
+
+            for (int i = 0; i < 2; i++) {
+                double errorX = fabs((double)approx[i].x - (double)exact.x);
+                double errorY = fabs((double)approx[i].y - (double)exact.y);
+                double error = (errorX > errorY) ? errorX : errorY;
+
+                if (error > maxError[i]) maxError[i] = error;
+                if (error != 0) mismatches[i]++;
+                totalError[i] += error;
+            }
+
+            vectorCount++;
+        }
+    }
+
+    std::cout << "=====Normalisation error vs exact (" << vectorCount <<
+            " vectors)=====" << std::endl;
+    for (int i = 0; i < 2; i++) {
+        std::cout << names[i] << ": max " << maxError[i] * 16 << " LSB, mean "
+                << (totalError[i] / vectorCount) * 16 << " LSB, "
+                << mismatches[i] << " differ" << std::endl;
+    }
+}
+
 /******************************************************************************/
 /*
  * Takes data to be transmitted and places it in an queue of data. This queue 
@@ -791,6 +861,9 @@ void tbPrintCommand(bool send, uint32 *data) {
     case CMD_BOID:
         std::cout << "boid in transit                   ";
         break;
+    case CMD_BOID_BATCH:
+        std::cout << "boids in transit                  ";
+        break;
     case MODE_DRAW:
         std::cout << "send boids to BoidGPU             ";
         break;
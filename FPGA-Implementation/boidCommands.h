@@ -0,0 +1,84 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * boidCommands.h
+ *
+ * The command definitions shared by the BoidCPU (boidCPU.h) and BoidMaster
+ * (boidMaster.h) cores and the host runtime (host/hostRuntime.cpp): the
+ * command header, the IDs, the command types and the indexes of the fields
+ * within the command bodies. Only #defines are held here, so the file can be
+ * included anywhere, including inside a namespace.
+ *
+ * The Gatekeeper keeps its own copy in boids.h, where CMD_LOAD_BAL has an
+ * older meaning.
+ *
+ ******************************************************************************/
+
+#ifndef BOID_COMMANDS_H_
+#define BOID_COMMANDS_H_
+
+/**************************** Constant Definitions ****************************/
+
+// Command definitions ---------------------------------------------------------
+#define CMD_HEADER_LEN          4   // The length of the command header
+#define MAX_CMD_BODY_LEN        30  // The max length of the command body
+#define MAX_CMD_LEN             (CMD_HEADER_LEN + MAX_CMD_BODY_LEN)
+
+#define CMD_LEN                 0   // The index of the command length
+#define CMD_TO                  1   // The index of the command target
+#define CMD_FROM                2   // The index of the command sender
+#define CMD_TYPE                3   // The index of the command type
+
+#define CMD_BROADCAST           0   // The number for a broadcast command
+#define CONTROLLER_ID           1   // The ID of the controller
+#define BOIDGPU_ID              2   // The ID of the BoidGPU
+#define FIRST_BOIDCPU_ID        3   // The lowest possible BoidCPU ID
+#define CMD_MULTICAST           99  // The 'to' value for multicast commands
+
+#define BOID_DATA_LENGTH        3   // The number of bits to send for a boid
+
+#define MODE_INIT               1   // Controller -> BoidCPU (Broadcast (B))
+#define CMD_PING                2   // Controller -> BoidCPU (B)
+#define CMD_PING_REPLY          3   // BoidCPU -> Controller (Direct (D))
+#define CMD_USER_INFO           4   // Controller -> BoidGPU (D)
+#define CMD_SIM_SETUP           5   // Controller -> Boid[CG]PU (D)
+#define MODE_CALC_NBRS          6   // Controller -> BoidCPU (B)
+#define CMD_PING_END            7   // Gatekeeper -> Controller (D)
+#define CMD_NBR_REPLY           8   // BoidCPU -> BoidCPU (D)
+#define MODE_POS_BOIDS          9   // Controller -> BoidCPU (B)
+#define MODE_LOAD_BAL           10  // Controller -> BoidCPU (?)
+#define MODE_TRAN_BOIDS         11  // Controller -> BoidCPU (B)
+#define CMD_BOID                12  // BoidCPU -> BoidCPU (D)
+#define MODE_DRAW               14  // Controller -> BoidCPU (B)
+#define CMD_DRAW_INFO           15  // BoidCPU -> BoidGPU (D)
+#define CMD_KILL                16  // Controller -> All (B)
+#define CMD_ACK                 17
+#define CMD_PING_START          18
+#define CMD_LOAD_BAL_REQUEST    19
+#define CMD_LOAD_BAL            20
+#define CMD_BOUNDS_AT_MIN       21
+#define CMD_BOID_BATCH          22  // BoidCPU -> BoidCPU (D)
+#define CMD_ACK_TREE            23  // Controller -> Gatekeeper (D)
+#define CMD_DEBUG               76
+
+#define CMD_SETUP_BNBRS_IDX     7   // Neighbouring BoidCPU start index
+#define CMD_SETUP_COORD_IDX     2   // Coordinates start index
+#define CMD_SETUP_NBCNT_IDX     6   // Distinct BoidCPU neighbour index
+#define CMD_SETUP_NEWID_IDX     0   // New BoidCPU ID index
+#define CMD_SETUP_BDCNT_IDX     1   // Initial boid count index
+#define CMD_SETUP_SIMWH_IDX     15  // The simulation width/height start index
+
+#define CMD_CALC_RBLD_IDX       0   // Neighbour list rebuild flags index
+#define CMD_ACK_RBLD_IDX        1   // Neighbour list rebuild flags index
+#define CMD_ACK_BDCNT_IDX       2   // Boid count (of the ACK subtree) index
+#define CMD_ACK_LOAD_IDX        3   // Largest BoidCPU boid count index
+#define CMD_ACK_CPUCNT_IDX      4   // BoidCPU count (of the ACK subtree) index
+
+#define CMD_TREE_PARENT_IDX     0   // ACK tree parent ID index
+#define CMD_TREE_CHILD_IDX      1   // ACK tree child Gatekeeper count index
+
+// Neighbour list rebuild flags (used when NBR_LIST_CACHING is defined) --------
+#define NBR_REBUILD_OWN         1   // A BoidCPU's own lists need rebuilding
+#define NBR_REBUILD_ALL         2   // Every BoidCPU's lists need rebuilding
+
+#endif /* BOID_COMMANDS_H_ */
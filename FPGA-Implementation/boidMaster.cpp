@@ -18,20 +18,33 @@
 
 #include "boidMaster.h"
 
+#ifdef HOST_RUNTIME
+#include <chrono>                   // For reporting the time step rate
+#endif
+
 /**************************** Constant Definitions ****************************/
 
 // #define USING_TESTBENCH          true    // Define when using HLS TestBench
 // #define LOAD_BALANCING_ENABLED   true    // Define to enable load balancing
+// #define NBR_LIST_CACHING         true    // Define to reuse neighbour lists
+// #define STREAMING_OUTPUT         true    // Define to write output directly
+// #define PIPELINED_STEPS          true    // Define to merge the compute phases
+// #define ASYNC_TIME_STEPS         true    // Define to step without barriers
+// #define ACK_TREE                 true    // Define to combine ACKs in a tree
+// #define ACK_TREE_DEBUG           true    // Define to print the ACK totals
 
 // TODO: Test with load balancing commented out
 // TODO: Move definations to header file
 
 #define MAX_BOIDCPUS            32      // TODO: Decide on a suitable value
 #define MAX_GATEKEEPERS         16      // TODO: Decide on a suitable value
+#define ACK_TREE_ARITY          4       // The children of each ACK tree node
 
 #define SIMULATION_WIDTH        1280    // The pixel width of the simulation
 #define SIMULATION_HEIGHT       720     // The pixel height of the simulation
 
+#define STEP_RATE_INTERVAL      100     // Time steps per step rate report
+
 // Indexes used when bitshifting the edge changes for load balancing a BoidCPU
 #define NORTH_IDX   12          // The index of the north edge change (load bal)
 #define EAST_IDX    8           // The index of the east edge change (load bal)
@@ -54,8 +67,16 @@ void issueCalcBoidMode();
 void issueTransferMode();
 void issueDrawMode();
 
+#ifdef ACK_TREE
+void issueAckTree();
+#endif
+
 void killSimulation();
 
+#ifdef HOST_RUNTIME
+void reportStepRate();
+#endif
+
 #ifdef LOAD_BALANCING_ENABLED
 void processLoadData();
 void issueLoadBalance();
@@ -65,7 +86,7 @@ void updateMinimalBoidCPUsList();
 void setupSimulation();
 void closestMultiples(uint12 *height, uint12 *width, uint8 number);
 
-void printCommand(bool send, uint32 *data);
+void printCommand(bool send, uint32 *header, uint32 *body);
 void createCommand(uint32 len, uint32 to, uint32 from, uint32 type,
         uint32 *data);
 
@@ -73,7 +94,7 @@ void createCommand(uint32 len, uint32 to, uint32 from, uint32 type,
 
 struct BoidCPU {
     uint8 boidCPUID;
-    uint8 boidCount;
+    uint16 boidCount;
     uint8 distinctNeighbourCount;
     uint12 boidCPUCoords[EDGE_COUNT];
     uint8 neighbours[MAX_BOIDCPU_NEIGHBOURS];
@@ -97,9 +118,14 @@ struct AckStruct {
 
 /**************************** Variable Definitions ****************************/
 
+#ifdef STREAMING_OUTPUT
+// The output port, bound by boidMaster(), that messages are written to
+hls::stream<uint32> *outputStream;
+#else
 uint32 outputData[MAX_OUTPUT_CMDS][MAX_CMD_LEN];
-uint32 inputData[MAX_CMD_LEN];
 uint32 outputCount = 0;
+#endif
+uint32 inputData[MAX_CMD_LEN];
 
 uint32 data[MAX_CMD_BODY_LEN];
 uint32 to;
@@ -110,6 +136,14 @@ uint32 dataLength = 0;
 AckStruct ackList[MAX_GATEKEEPERS];
 #endif
 
+#ifdef ACK_TREE
+uint32 gatekeeperIDs[MAX_GATEKEEPERS];      // The Gatekeepers in ping order
+uint8 ackTreeChildCount = 0;                // The ACKs expected at the root
+uint32 ackBoidCount = 0;                    // The boids reported by the ACKs
+uint32 ackMaxLoad = 0;                      // The largest BoidCPU boid count
+uint8 ackBoidCPUCount = 0;                  // The BoidCPUs covered by the ACKs
+#endif
+
 uint8 state = CMD_PING;                     // The current simulation state
 uint8 ackCount = 0;                         // The number of ACKs received
 uint8 gatekeeperCount = 0;
@@ -126,9 +160,22 @@ uint8 gridAssignment[MAX_BOIDCPUS][MAX_BOIDCPUS];
 
 uint32 boidCount = 100;                     // Initial num of simulation boids
 
-// Controls main infinite loop, only false if HLS TestBench is being used
+#ifdef NBR_LIST_CACHING
+// The NBR_REBUILD_* flags of the BoidCPUs' neighbour lists for the next step
+uint8 nbrListRebuild = NBR_REBUILD_ALL;
+#endif
+
+// Controls main infinite loop, only false if HLS TestBench is being used or
+// the host runtime has killed the simulation
 bool continueOperation = true;
 
+#ifdef HOST_RUNTIME
+// The start of the current step rate report interval and the time steps 
+// completed within it
+std::chrono::steady_clock::time_point stepRateStart;
+uint32 stepRateCounter = 0;
+#endif
+
 /******************************************************************************/
 /*
  * The top level function of the BoidMaster core - containing the only external
@@ -152,6 +199,10 @@ void boidMaster(hls::stream<uint32> &input, hls::stream<uint32> &output) {
 #pragma HLS RESOURCE variable = output core = AXI4Stream
 #pragma HLS INTERFACE ap_ctrl_none port = return
 
+#ifdef STREAMING_OUTPUT
+    outputStream = &output;
+#endif
+
 // Note that reading an empty input stream will generate warnings in HLS 
 // (TestBench), but should be blocking in the actual implementation.
 
@@ -171,7 +222,7 @@ void boidMaster(hls::stream<uint32> &input, hls::stream<uint32> &output) {
         inputLoop: for (int i = 1; i < inputData[CMD_LEN]; i++) {
             inputData[i] = input.read();
         }
-        printCommand(false, inputData);
+        printCommand(false, inputData, &inputData[CMD_HEADER_LEN]);
         // ---------------------------------------------------------------------
 
         // STATE CHANGE --------------------------------------------------------
@@ -189,6 +240,9 @@ void boidMaster(hls::stream<uint32> &input, hls::stream<uint32> &output) {
                 break;
             case CMD_PING_END:
                 pingEnd = true;
+#ifdef ACK_TREE
+                issueAckTree();
+#endif
                 break;
 #ifdef LOAD_BALANCING_ENABLED
             case CMD_LOAD_BAL_REQUEST:
@@ -201,6 +255,12 @@ void boidMaster(hls::stream<uint32> &input, hls::stream<uint32> &output) {
             case CMD_ACK:
                 processAck();
                 break;
+#ifdef HOST_RUNTIME
+            case CMD_KILL:
+                // Stop the BoidMaster so that its host thread can be joined
+                continueOperation = false;
+                break;
+#endif
             default:
                 std::cout << "Command state " << inputData[CMD_TYPE]
                         << " not recognised" << std::endl;
@@ -211,6 +271,7 @@ void boidMaster(hls::stream<uint32> &input, hls::stream<uint32> &output) {
         }
         // ---------------------------------------------------------------------
 
+#ifndef STREAMING_OUTPUT
         // OUTPUT --------------------------------------------------------------
         // If there is output to send, send it
         if (outputCount > 0) {
@@ -218,11 +279,13 @@ void boidMaster(hls::stream<uint32> &input, hls::stream<uint32> &output) {
                 innerOutLoop: for (int i = 0; i < outputData[j][CMD_LEN]; i++) {
                     output.write(outputData[j][i]);
                 }
-                printCommand(true, outputData[j]);
+                printCommand(true, outputData[j],
+                        &outputData[j][CMD_HEADER_LEN]);
             }
         }
         outputCount = 0;
         // ---------------------------------------------------------------------
+#endif
 
 #ifdef USING_TESTBENCH
         continueOperation = input.read_nb(inputData[0]);
@@ -278,6 +341,9 @@ void processPingReply() {
 #ifdef LOAD_BALANCING_ENABLED
     ackList[gatekeeperCount].gatekeeperID = inputData[CMD_FROM];
 #endif
+#ifdef ACK_TREE
+    gatekeeperIDs[gatekeeperCount] = inputData[CMD_FROM];
+#endif
 
     uint8 gatekeeperBoidCPUCount = inputData[CMD_HEADER_LEN + 0];
     gatekeeperCount++;
@@ -328,8 +394,8 @@ void processPingReply() {
  ******************************************************************************/
 void setupSimulation() {
     // Define initial boids counts
-    uint12 boidsPerBoidCPU = boidCount / boidCPUCount;
-    uint12 remainingBoids = (boidCount - (boidsPerBoidCPU * boidCPUCount));
+    uint16 boidsPerBoidCPU = boidCount / boidCPUCount;
+    uint16 remainingBoids = (boidCount - (boidsPerBoidCPU * boidCPUCount));
 
     setupBoidCountLoop: for (int i = 0; i < boidCPUCount; i++) {
         if (i == (boidCPUCount - 1)) {
@@ -523,6 +589,32 @@ void closestMultiples(uint12 *height, uint12 *width, uint8 number) {
  * is from does not have any affected BoidCPUs. Otherwise, it is ignored. For
  * gatekeepers that have affected BoidCPUs, another ACK will be sent.
  *
+ * If NBR_LIST_CACHING is defined, the MODE_TRAN_BOIDS ACKs carry flags that 
+ * are set if any BoidCPU needs its cached neighbour lists rebuilt. If no ACK 
+ * has a flag set, and no load balancing has occurred, the next time step 
+ * skips the MODE_CALC_NBRS phase and starts at MODE_POS_BOIDS. Otherwise, the 
+ * flags are passed on with MODE_CALC_NBRS so that the BoidCPUs know whether 
+ * every list is to be rebuilt or only those that they have flagged.
+ *
+ * If PIPELINED_STEPS is defined, the BoidCPUs update the positions of their 
+ * boids as soon as their neighbours are known and only ACK afterwards, so the 
+ * MODE_CALC_NBRS phase is followed directly by MODE_TRAN_BOIDS. This leaves 
+ * one ACK barrier before the transfer and one before the draw in each time 
+ * step, rather than one per phase.
+ *
+ * If ASYNC_TIME_STEPS is defined, the BoidCPUs synchronise with their 
+ * neighbours using step-tagged messages and start each time step themselves. 
+ * Once the setup has been ACKed, the BoidMaster issues MODE_CALC_NBRS once to 
+ * start the first time step, and from then on the BoidGPU ACKs are only used 
+ * to monitor the progress of the simulation.
+ *
+ * If ACK_TREE is defined, the Gatekeepers combine their ACKs in a tree (see 
+ * issueAckTree()) and only the Gatekeepers at the top of the tree ACK the 
+ * BoidMaster. Each of these ACKs also carries the boid count, the largest 
+ * BoidCPU boid count and the BoidCPU count of its subtree, which are totalled 
+ * and reported when the stage is complete. Load balancing is not supported 
+ * with ACK_TREE as the BoidMaster no longer knows which Gatekeeper sent an ACK.
+ *
  * @param   None
  * 
  * @return  None
@@ -530,10 +622,45 @@ void closestMultiples(uint12 *height, uint12 *width, uint8 number) {
  ******************************************************************************/
 void processAck() {
     if (inputData[CMD_FROM] == BOIDGPU_ID) {
+#ifdef HOST_RUNTIME
+        reportStepRate();
+#endif
+
+#if defined(ASYNC_TIME_STEPS)
+        // The BoidCPUs start each time step themselves
+#elif defined(NBR_LIST_CACHING)
+        if (nbrListRebuild != 0) {
+            state = MODE_CALC_NBRS;
+            issueCalcNbrsMode();
+        } else {
+            state = MODE_POS_BOIDS;
+            issueCalcBoidMode();
+        }
+
+        // Collect the flags for the next time step
+        nbrListRebuild = 0;
+#else
         state = MODE_CALC_NBRS;
         issueCalcNbrsMode();
+#endif
         ackCount = 0;
     } else {
+#ifdef NBR_LIST_CACHING
+        if ((state == MODE_TRAN_BOIDS) &&
+                (inputData[CMD_LEN] > CMD_HEADER_LEN + CMD_ACK_RBLD_IDX)) {
+            nbrListRebuild |= inputData[CMD_HEADER_LEN + CMD_ACK_RBLD_IDX];
+        }
+#endif
+#ifdef ACK_TREE
+        if (inputData[CMD_LEN] > CMD_HEADER_LEN + CMD_ACK_CPUCNT_IDX) {
+            ackBoidCount += inputData[CMD_HEADER_LEN + CMD_ACK_BDCNT_IDX];
+            ackBoidCPUCount += inputData[CMD_HEADER_LEN + CMD_ACK_CPUCNT_IDX];
+
+            if (inputData[CMD_HEADER_LEN + CMD_ACK_LOAD_IDX] > ackMaxLoad) {
+                ackMaxLoad = inputData[CMD_HEADER_LEN + CMD_ACK_LOAD_IDX];
+            }
+        }
+#endif
         ackCount++;
 #ifdef LOAD_BALANCING_ENABLED
         for (int i = 0; i < gatekeeperCount; i++) {
@@ -554,15 +681,36 @@ void processAck() {
         }
 #endif
     }
+#ifdef ACK_TREE
+    if (ackCount == ackTreeChildCount) {
+#ifdef ACK_TREE_DEBUG
+        std::cout << "ACK tree: " << ackBoidCount << " boids on " <<
+                ackBoidCPUCount << " of " << boidCPUCount << " BoidCPUs (at "
+                "most " << ackMaxLoad << " on one BoidCPU)" << std::endl;
+#endif
+        ackBoidCount = 0;
+        ackMaxLoad = 0;
+        ackBoidCPUCount = 0;
+#else
     if (ackCount == gatekeeperCount) {
+#endif
         switch(state) {
         case CMD_SIM_SETUP:
+#ifdef HOST_RUNTIME
+            stepRateStart = std::chrono::steady_clock::now();
+#endif
             state = MODE_CALC_NBRS;
             issueCalcNbrsMode();
             break;
         case MODE_CALC_NBRS:
+#ifdef PIPELINED_STEPS
+            // The BoidCPUs have also updated the positions of their boids
+            state = MODE_TRAN_BOIDS;
+            issueTransferMode();
+#else
             state = MODE_POS_BOIDS;
             issueCalcBoidMode();
+#endif
             break;
         case MODE_POS_BOIDS:
             state = MODE_TRAN_BOIDS;
@@ -657,6 +805,11 @@ void processLoadData() {
     }
     std::cout << std::endl;
 
+#ifdef NBR_LIST_CACHING
+    // The BoidCPU bounds are changing, so the neighbour lists must be rebuilt
+    nbrListRebuild |= NBR_REBUILD_ALL;
+#endif
+
     // Determine changes for other, affected BoidCPUs
     for (int i = 0; i < boidCPUCount; i++) {
         int16 affectedBoidCPUEdgeChanges = 0;
@@ -835,6 +988,58 @@ void issueSetupInformation() {
     }
 }
 
+#ifdef ACK_TREE
+/******************************************************************************/
+/*
+ * Tell each Gatekeeper where it sits in the ACK tree, once all the ping 
+ * replies have been received. The tree is a complete ACK_TREE_ARITY-ary tree 
+ * with the BoidMaster as node 0 and the Gatekeepers, in the order that they 
+ * replied to the ping, as nodes 1 onwards. A Gatekeeper waits for the ACKs of 
+ * its resident BoidCPUs and those of its child Gatekeepers before sending a 
+ * single ACK to its parent, so the BoidMaster receives at most ACK_TREE_ARITY 
+ * ACKs per stage and an ACK passes through O(log N) Gatekeepers. 
+ * 
+ * Each Gatekeeper is sent the ID of its parent (CONTROLLER_ID for the nodes 
+ * under the BoidMaster) and the number of child Gatekeepers it has. 
+ *
+ * @param   None
+ * 
+ * @return  None
+ *
+ ******************************************************************************/
+void issueAckTree() {
+    ackTreeLoop: for (int i = 0; i < gatekeeperCount; i++) {
+        uint8 parentNode = i / ACK_TREE_ARITY;
+        uint8 firstChildNode = ((i + 1) * ACK_TREE_ARITY) + 1;
+        uint8 childCount = 0;
+
+        if (firstChildNode <= gatekeeperCount) {
+            childCount = gatekeeperCount - firstChildNode + 1;
+            if (childCount > ACK_TREE_ARITY) {
+                childCount = ACK_TREE_ARITY;
+            }
+        }
+
+        if (parentNode == 0) {
+            data[CMD_TREE_PARENT_IDX] = CONTROLLER_ID;
+        } else {
+            data[CMD_TREE_PARENT_IDX] = gatekeeperIDs[parentNode - 1];
+        }
+        data[CMD_TREE_CHILD_IDX] = childCount;
+
+        dataLength = 2;
+        to = gatekeeperIDs[i];
+        createCommand(dataLength, to, from, CMD_ACK_TREE, data);
+    }
+
+    if (gatekeeperCount < ACK_TREE_ARITY) {
+        ackTreeChildCount = gatekeeperCount;
+    } else {
+        ackTreeChildCount = ACK_TREE_ARITY;
+    }
+}
+#endif
+
 /******************************************************************************/
 /*
  * Send user-inputted data (such as flock size and flock rule weightings) to 
@@ -855,6 +1060,9 @@ void sendUserDataToBoidGPU() {
  * Signal the start of the calculate neighbours phase of the simulation. Here, 
  * boid neighbours are calculated based on distance to other boids.
  *
+ * If NBR_LIST_CACHING is defined, the message carries the neighbour list 
+ * rebuild flags collected from the last time step.
+ *
  * @param   None
  * 
  * @return  None
@@ -862,7 +1070,12 @@ void sendUserDataToBoidGPU() {
  ******************************************************************************/
 void issueCalcNbrsMode() {
     to = CMD_BROADCAST;
+#ifdef NBR_LIST_CACHING
+    data[CMD_CALC_RBLD_IDX] = nbrListRebuild;
+    dataLength = CMD_CALC_RBLD_IDX + 1;
+#else
     dataLength = 0;
+#endif
     createCommand(dataLength, to, from, MODE_CALC_NBRS, data);
 }
 
@@ -967,6 +1180,9 @@ void killSimulation() {
  * access to the input and output ports. If the output queue is full, the 
  * new data is not added.
  *
+ * If STREAMING_OUTPUT is defined, the message is instead written straight to 
+ * the output port bound by boidMaster(), so there is no queue to fill.
+ *
  * @param   len     The length of the message body
  * @param   to      The ID of the recipient of the message
  * @param   type    The type of the message (defined in boidMaster.h)
@@ -976,6 +1192,23 @@ void killSimulation() {
  *
  ******************************************************************************/
 void createCommand(uint32 len, uint32 to, uint32 from, uint32 type, uint32 *data) {
+#ifdef STREAMING_OUTPUT
+    uint32 header[CMD_HEADER_LEN];
+    header[CMD_LEN] = len + CMD_HEADER_LEN;
+    header[CMD_TO] = to;
+    header[CMD_FROM] = from;
+    header[CMD_TYPE] = type;
+
+    headerToStream: for (int i = 0; i < CMD_HEADER_LEN; i++) {
+        outputStream->write(header[i]);
+    }
+
+    dataToStream: for (int i = 0; i < len; i++) {
+        outputStream->write(data[i]);
+    }
+
+    printCommand(true, header, data);
+#else
     outputData[outputCount][CMD_LEN] = len + CMD_HEADER_LEN;
     outputData[outputCount][CMD_TO] = to;
     outputData[outputCount][CMD_FROM] = from;
@@ -988,47 +1221,88 @@ void createCommand(uint32 len, uint32 to, uint32 from, uint32 type, uint32 *data
     }
 
     outputCount++;
+#endif
 }
 
 //============================================================================//
 // Debug ---------------------------------------------------------------------//
 //============================================================================//
 
+#ifdef HOST_RUNTIME
+/******************************************************************************/
+/*
+ * Counts a completed time step and, every STEP_RATE_INTERVAL time steps, 
+ * reports the number of time steps simulated per second along with the step 
+ * mode in use. The rate is printed with printf() so that it is still shown 
+ * when the host runtime discards the output of the cores.
+ *
+ * @param   None
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void reportStepRate() {
+    stepRateCounter++;
+
+    if (stepRateCounter == STEP_RATE_INTERVAL) {
+        std::chrono::steady_clock::time_point now =
+                std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now -
+                stepRateStart).count();
+
+#if defined(ASYNC_TIME_STEPS)
+        const char *stepMode = "asynchronous";
+#elif defined(PIPELINED_STEPS)
+        const char *stepMode = "pipelined";
+#else
+        const char *stepMode = "phased";
+#endif
+
+        printf("BoidMaster: %.1f time steps/s (%s steps)\n",
+                STEP_RATE_INTERVAL / seconds, stepMode);
+
+        stepRateStart = now;
+        stepRateCounter = 0;
+    }
+}
+#endif
+
 /******************************************************************************/
 /*
  * Parses a message and prints it out to the standard output.
  *
  * @param   send    True if the message is being sent, false otherwise
- * @param   data    The array containing the message
+ * @param   header  The array containing the message header
+ * @param   body    The array containing the message body
  *
  * @return  None
  *
  ******************************************************************************/
-void printCommand(bool send, uint32 *data) {
+void printCommand(bool send, uint32 *header, uint32 *body) {
     if (send) {
-        if (data[CMD_TO] == CMD_BROADCAST) {
+        if (header[CMD_TO] == CMD_BROADCAST) {
             std::cout << "-> TX, BoidMaster sent broadcast:                  ";
-        } else if (data[CMD_TO] == BOIDGPU_ID) {
+        } else if (header[CMD_TO] == BOIDGPU_ID) {
             std::cout << "-> TX, BoidMaster sent command to BoidGPU:         ";
         } else {
-            std::cout << "-> TX, BoidMaster sent command to " << data[CMD_TO]
+            std::cout << "-> TX, BoidMaster sent command to " << header[CMD_TO]
                     << ":              ";
         }
     } else {
-        if (data[CMD_TO] == CMD_BROADCAST) {
+        if (header[CMD_TO] == CMD_BROADCAST) {
             // This should never happen - only the controller can broadcast
             std::cout << "<- RX, BoidMaster received broadcast from "
-                    << data[CMD_FROM] << ":      ";
-        } else if (data[CMD_FROM] == BOIDGPU_ID) {
+                    << header[CMD_FROM] << ":      ";
+        } else if (header[CMD_FROM] == BOIDGPU_ID) {
             // This should never happen - BoidGPU should just receive
             std::cout << "<- RX, BoidMaster received command from BoidGPU:   ";
         } else {
             std::cout << "<- RX, BoidMaster received command from "
-                    << data[CMD_FROM] << ":        ";
+                    << header[CMD_FROM] << ":        ";
         }
     }
 
-    switch (data[CMD_TYPE]) {
+    switch (header[CMD_TYPE]) {
     case MODE_INIT:
         std::cout << "initialise self                   ";
         break;
@@ -1062,6 +1336,9 @@ void printCommand(bool send, uint32 *data) {
     case CMD_BOID:
         std::cout << "boid in transit                   ";
         break;
+    case CMD_BOID_BATCH:
+        std::cout << "boids in transit                  ";
+        break;
     case MODE_DRAW:
         std::cout << "send boids to BoidGPU             ";
         break;
@@ -1071,6 +1348,9 @@ void printCommand(bool send, uint32 *data) {
     case CMD_ACK:
         std::cout << "ACK signal                        ";
         break;
+    case CMD_ACK_TREE:
+        std::cout << "ACK tree position                 ";
+        break;
     case CMD_PING_END:
         std::cout << "end of ping                       ";
         break;
@@ -1084,18 +1364,18 @@ void printCommand(bool send, uint32 *data) {
         std::cout << "debug information                 ";
         break;
     default:
-        std::cout << "UNKNOWN COMMAND: (" << data[CMD_TYPE] << ")             ";
+        std::cout << "UNKNOWN COMMAND: (" << header[CMD_TYPE] << ")             ";
         break;
     }
 
     int i = 0;
     for (i = 0; i < CMD_HEADER_LEN; i++) {
-        std::cout << data[i] << " ";
+        std::cout << header[i] << " ";
     }
     std::cout << "|| ";
 
-    for (i = 0; i < data[CMD_LEN] - CMD_HEADER_LEN; i++) {
-        std::cout << data[CMD_HEADER_LEN + i] << " ";
+    for (i = 0; i < header[CMD_LEN] - CMD_HEADER_LEN; i++) {
+        std::cout << body[i] << " ";
     }
     std::cout << std::endl;
 }
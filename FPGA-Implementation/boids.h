@@ -68,6 +68,8 @@
 #define CMD_KILL                16  // Controller -> All
 #define CMD_ACK                 17  // All -> Controller
 #define CMD_PING_START          18
+#define CMD_BOID_BATCH          22  // BoidCPU -> BoidCPU
+#define CMD_ACK_TREE            23  // Controller -> Gatekeeper
 #define CMD_DEBUG               76
 
 #define CMD_COUNT               19
@@ -79,6 +81,14 @@
 #define CMD_SETUP_BDCNT_IDX     1   // Initial boid count index
 #define CMD_SETUP_SIMWH_IDX     15  // The simulation width/height start index
 
+#define CMD_ACK_RBLD_IDX        1   // Neighbour list rebuild flag index
+#define CMD_ACK_BDCNT_IDX       2   // Boid count (of the ACK subtree) index
+#define CMD_ACK_LOAD_IDX        3   // Largest BoidCPU boid count index
+#define CMD_ACK_CPUCNT_IDX      4   // BoidCPU count (of the ACK subtree) index
+
+#define CMD_TREE_PARENT_IDX     0   // ACK tree parent ID index
+#define CMD_TREE_CHILD_IDX      1   // ACK tree child Gatekeeper count index
+
 // BoidCPU definitions ---------------------------------------------------------
 #define EDGE_COUNT              4   // The number of edges a BoidCPU has
 #define MAX_BOIDCPU_NEIGHBOURS  8   // The maximum neighbours a BoidCPUs has
@@ -0,0 +1,143 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * ethernetCodec.h
+ *
+ * The functions that the Gatekeeper (gatekeeper.c) uses to convert commands,
+ * which are made of 32-bit words, to and from the bytes of an Ethernet frame.
+ * The words are sent most significant byte first (big-endian).
+ *
+ * encodeEthernetMessage() and decodeEthernetMessage() convert a single word.
+ * encodeEthernetWords() and decodeEthernetWords() convert a whole command, or
+ * a part of one, at a time. On a big-endian processor, or one known to have a
+ * byte swap instruction (x86, ARMv6 and later), these copy whole words rather
+ * than masking and shifting each byte. Elsewhere, including a MicroBlaze
+ * without the reorder instructions, where a byte swap is a library call, the
+ * bytes are still shifted. ETHERNET_WORD can be defined before this file is
+ * included to choose for another processor. host/ethernetBenchmark.cpp
+ * compares converting a command at a time with a word at a time.
+ *
+ ******************************************************************************/
+
+#ifndef ETHERNET_CODEC_H_
+#define ETHERNET_CODEC_H_
+
+/******************************** Include Files *******************************/
+
+#include <string.h>         // For memcpy()
+
+/**************************** Constant Definitions ****************************/
+
+// Converts between a word in memory and a big-endian word in a frame
+#if !defined(ETHERNET_WORD) && defined(__GNUC__) && defined(__BYTE_ORDER__)
+#if (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define ETHERNET_WORD(value)    (value)
+#elif defined(__i386__) || defined(__x86_64__) || defined(__aarch64__) || \
+        (defined(__ARM_ARCH) && (__ARM_ARCH >= 6))
+#define ETHERNET_WORD(value)    __builtin_bswap32(value)
+#endif
+#endif
+
+/*************************** Function Definitions *****************************/
+
+/******************************************************************************/
+/*
+ * Splits a 32-bit value into four 8-bit values for transmission over Ethernet.
+ *
+ * @param   outputValue         The 32-bit value to split into 4 8-bit values
+ * @param   outputArrayPointer  A pointer to the array to store the results
+ * @param   idx                 The index location in the array to store at
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+static inline void encodeEthernetMessage(u32 outputValue,
+        u8* outputArrayPointer, int* idx) {
+    outputArrayPointer[*idx + 0] = (outputValue & 0xff000000UL) >> 24;
+    outputArrayPointer[*idx + 1] = (outputValue & 0x00ff0000UL) >> 16;
+    outputArrayPointer[*idx + 2] = (outputValue & 0x0000ff00UL) >>  8;
+    outputArrayPointer[*idx + 3] = (outputValue & 0x000000ffUL);
+
+    *idx += 4;
+}
+
+/******************************************************************************/
+/*
+ * Take four 8 bit values from Ethernet and combine into one 32 bit value
+ *
+ * @param   inputZero   The most significant 8-bit byte
+ * @param   inputOne    The second most significant 8-bit byte
+ * @param   inputTwo    The second least significant 8-bit byte
+ * @param   inputThree  The least significant 8-bit byte
+ *
+ * @return              An unsigned 32-bit integer of the combined input bytes
+ *
+ ******************************************************************************/
+static inline u32 decodeEthernetMessage(u8 inputZero, u8 inputOne,
+        u8 inputTwo, u8 inputThree) {
+    return (u32)((inputZero << 24) | (inputOne << 16) | (inputTwo << 8) | (inputThree));
+}
+
+/******************************************************************************/
+/*
+ * Splits a number of 32-bit values into 8-bit values for transmission over
+ * Ethernet. The output does not need to be word aligned.
+ *
+ * @param   values      The 32-bit values to split
+ * @param   count       The number of values to split
+ * @param   output      A pointer to the array to store the results
+ * @param   idx         The index location in the array to store at, which is
+ *                      advanced past the stored values
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+static inline void encodeEthernetWords(const u32 *values, int count,
+        u8 *output, int *idx) {
+    int i = 0;
+    u8 *position = &output[*idx];
+
+    for (i = 0; i < count; i++, position += 4) {
+#ifdef ETHERNET_WORD
+        u32 word = ETHERNET_WORD(values[i]);
+        memcpy(position, &word, 4);
+#else
+        position[0] = (u8)(values[i] >> 24);
+        position[1] = (u8)(values[i] >> 16);
+        position[2] = (u8)(values[i] >>  8);
+        position[3] = (u8)(values[i]);
+#endif
+    }
+
+    *idx += count * 4;
+}
+
+/******************************************************************************/
+/*
+ * Combines the 8-bit values received over Ethernet into a number of 32-bit
+ * values. The input does not need to be word aligned.
+ *
+ * @param   input       A pointer to the first byte of the first value
+ * @param   count       The number of values to combine
+ * @param   values      The array to store the combined values in
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+static inline void decodeEthernetWords(const u8 *input, int count,
+        u32 *values) {
+    int i = 0;
+
+    for (i = 0; i < count; i++, input += 4) {
+#ifdef ETHERNET_WORD
+        u32 word;
+        memcpy(&word, input, 4);
+        values[i] = ETHERNET_WORD(word);
+#else
+        values[i] = ((u32)input[0] << 24) | ((u32)input[1] << 16) |
+                ((u32)input[2] << 8) | (u32)input[3];
+#endif
+    }
+}
+
+#endif /* ETHERNET_CODEC_H_ */
@@ -0,0 +1,102 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * eventSource.h
+ *
+ * The event-driven input loop of the Gatekeeper (gatekeeper.c), used when
+ * EVENT_DRIVEN_LOOP is defined. The loop waits until there is an event, then
+ * reads only the FSL channels that have signalled data. The channels take
+ * turns to go first, and a quota of messages is taken from a channel per call
+ * so that a busy BoidCPU cannot hold up the others.
+ *
+ * The events come from an EventSource. On the Gatekeeper, the FSL and
+ * Ethernet interrupt handlers set the flags that the source reports. The
+ * MicroBlaze used has no sleep instruction, so waitForEvents() still spins: it
+ * saves reading every FSL channel on each pass, not processor time.
+ * host/eventSourceTest.cpp provides an EventSource of synthetic message
+ * queues to test the loop.
+ *
+ ******************************************************************************/
+
+#ifndef EVENT_SOURCE_H_
+#define EVENT_SOURCE_H_
+
+/**************************** Type Definitions ********************************/
+
+typedef struct {
+    // 1 if there is an event other than FSL data, such as a received frame
+    int (*otherEventWaiting)(void);
+    // 1 if the channel has signalled that it has data
+    int (*channelSignalled)(u32 channel);
+    // Reads a message from the channel, returning 1 if there was one
+    int (*readChannel)(u32 channel, u32 *data);
+    // Called once the channel is empty, to wait for its next signal
+    void (*channelDrained)(u32 channel);
+    // Processes a message read from a channel
+    void (*processMessage)(u32 *data);
+} EventSource;
+
+/*************************** Function Definitions *****************************/
+
+/******************************************************************************/
+/*
+ * Waits until there is an event: a channel that has signalled data or another
+ * event reported by the source. No channel is read while waiting.
+ *
+ * @param   source          The source of the events
+ * @param   channelCount    The number of FSL channels
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+static inline void waitForEvents(const EventSource *source, u32 channelCount) {
+    u32 channel = 0;
+
+    while (!source->otherEventWaiting()) {
+        for (channel = 0; channel < channelCount; channel++) {
+            if (source->channelSignalled(channel)) {
+                return;
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ * Processes the messages waiting on the channels that have signalled data,
+ * starting with firstChannel. At most quota messages are taken from a
+ * channel. A channel found to be empty is passed to channelDrained().
+ *
+ * @param   source          The source of the events
+ * @param   channelCount    The number of FSL channels
+ * @param   quota           The most messages to take from a channel
+ * @param   firstChannel    The channel to service first
+ * @param   data            A buffer large enough for any message
+ *
+ * @return                  The channel to service first on the next call
+ *
+ ******************************************************************************/
+static inline u32 serviceChannels(const EventSource *source, u32 channelCount,
+        u32 quota, u32 firstChannel, u32 *data) {
+    u32 channel = firstChannel;
+    u32 i = 0, j = 0;
+
+    for (i = 0; i < channelCount; i++) {
+        if (source->channelSignalled(channel)) {
+            for (j = 0; j < quota; j++) {
+                if (!source->readChannel(channel, data)) {
+                    source->channelDrained(channel);
+                    break;
+                }
+
+                source->processMessage(data);
+            }
+        }
+
+        channel = (channel + 1) % channelCount;
+    }
+
+    return (firstChannel + 1) % channelCount;
+}
+
+#endif /* EVENT_SOURCE_H_ */
@@ -41,6 +41,9 @@
 #include <stdint.h>         // For specific data types e.g. int16_t
 
 #include "boids.h"          // Boid definitions
+#include "ethernetCodec.h"  // Converts commands to and from Ethernet frames
+#include "receiveRing.h"    // Holds received frames until they are processed
+#include "eventSource.h"    // Waits for and services the FSL channels
 
 /************************** Gatekeeper Configuration **************************/
 
@@ -48,38 +51,83 @@
  * The setup presented here is for an FPGA containing 1 BoidMaster core and
  * 2 BoidCPU cores with the gatekeeper also acting as the BoidGPU.
  *
- * When changing the number of BoidCPUs that this gatekeeper serves, the user
- * will also manually need to add extra code in the checkForInput(),
- * sendInternalMessage(), getFSLData() and putFSLData(). This is primarily due
- * to the Xilinx putfslx() and getfslx() method not allowing a variable channel
- * name.
- *
- * TODO: Investigate ways of reducing the number of changes that need to be
- * made when changing the number of BoidCPUs e.g. with a configuration file
+ * When changing the number of BoidCPUs that this gatekeeper serves, only
+ * RESIDENT_BOIDCPU_COUNT needs to be changed. The BoidMaster, if resident, is
+ * on FSL channel 0 and the BoidCPUs are on the channels that follow it. A
+ * MicroBlaze has at most 16 FSL channels.
  */
 
 #define MASTER_IS_RESIDENT      1   // Define when the BoidMaster is resident
 #define ACT_AS_BOIDGPU          1   // Define if acting as BoidGPU
 #define DEBUG                   1   // Define to print out debug messages
+// #define NBR_LIST_CACHING        1   // Define if the BoidCPUs define it
+// #define ASYNC_TIME_STEPS        1   // Define if the BoidCPUs define it
+// #define ACK_TREE                1   // Define if the BoidMaster defines it
+// #define FRAME_BATCHING          1   // Define to send many commands per frame
+// #define ROUTING_TABLE           1   // Define to route with a look-up table
+// #define MAC_LEARNING            1   // Define to send direct messages unicast
+// #define EVENT_DRIVEN_LOOP       1   // Define to wait for FSL interrupts
 
 #define RESIDENT_BOIDCPU_COUNT  2   // The number of resident BoidCPUs
 
 #ifdef MASTER_IS_RESIDENT
 #define BOIDMASTER_CHANNEL      0
+#define FIRST_BOIDCPU_CHANNEL   1
+#else
+#define FIRST_BOIDCPU_CHANNEL   0
 #endif
 
-#define BOIDCPU_CHANNEL_1       1
-#define BOIDCPU_CHANNEL_2       2
+#define FSL_CHANNEL_COUNT       (FIRST_BOIDCPU_CHANNEL + RESIDENT_BOIDCPU_COUNT)
+
+#if FSL_CHANNEL_COUNT > 16
+#error "A MicroBlaze has at most 16 FSL channels"
+#endif
+
+#ifdef EVENT_DRIVEN_LOOP
+// The data exists (FSL_S_Exists) signal of each FSL channel drives a level 
+// sensitive interrupt controller input, starting at FSL_INTERRUPT_BASE for 
+// channel 0 and following in channel order. 
+#define FSL_INTERRUPT_BASE      1
+#define FSL_INTERRUPT_ID(channel)   (FSL_INTERRUPT_BASE + (channel))
+
+#if (FSL_INTERRUPT_BASE + FSL_CHANNEL_COUNT) > 32
+#error "The interrupt controller has at most 32 inputs"
+#endif
+#endif
 
 static u8 own_mac_address[XEL_MAC_ADDR_SIZE] = {0x00, 0x0A, 0x35, 0x01, 0x02, 0x03};
-u32 gatekeeperID = 999;
+static u8 broadcast_mac_address[XEL_MAC_ADDR_SIZE] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// Every Gatekeeper has the shared ID unless it is built with its own 
+// GATEKEEPER_ID. The ACK tree addresses the Gatekeepers by ID, so it needs a 
+// distinct ID for each.
+#define SHARED_GATEKEEPER_ID    999
+#ifndef GATEKEEPER_ID
+#define GATEKEEPER_ID           SHARED_GATEKEEPER_ID
+#endif
+
+#if defined(ACK_TREE) && (GATEKEEPER_ID == SHARED_GATEKEEPER_ID)
+#error "ACK_TREE needs a distinct GATEKEEPER_ID for each Gatekeeper"
+#endif
+
+u32 gatekeeperID = GATEKEEPER_ID;
 
 /**************************** Constant Definitions ****************************/
 
 #define BOID_DATA_LENGTH        3
 #define EXT_INPUT_SIZE          8   // Number of received external messages to hold
+#define EXT_INPUTS_PER_PASS     1   // Received messages to process per pass
+#define CHANNEL_QUOTA           4   // FSL messages to process per channel turn
+#define MIN_FRAME_SIZE          64  // Frames are padded to at least this size
+#define MAX_FRAME_SIZE          (XEL_HEADER_SIZE + XEL_MTU_SIZE)
 
 #define ALL_BOIDCPU_CHANNELS    99  // When a message is sent to all channels
+#define BOIDCPU_CHANNEL_MASK    (((1u << RESIDENT_BOIDCPU_COUNT) - 1) << \
+                                    FIRST_BOIDCPU_CHANNEL)
+
+#define STEP_WINDOW             16  // Time steps that draws can be spread over
+#define ROUTING_TABLE_SIZE      256 // One entry for every 8-bit BoidCPU ID
+#define MAC_TABLE_SIZE          1024    // IDs below this have MACs learnt
 
 #define KILL_KEY                0x6B    // 'k'
 #define PAUSE_KEY               0x70    // 'p'
@@ -92,32 +140,48 @@ u32 gatekeeperID = 999;
 #define INTC_DEVICE_ID      XPAR_INTC_0_DEVICE_ID
 #define INTC_EMACLITE_ID    XPAR_INTC_0_EMACLITE_0_VEC_ID
 
+#if defined(EVENT_DRIVEN_LOOP) && (INTC_EMACLITE_ID >= FSL_INTERRUPT_BASE) && \
+        (INTC_EMACLITE_ID < (FSL_INTERRUPT_BASE + FSL_CHANNEL_COUNT))
+#error "The FSL interrupts overlap the EmacLite interrupt"
+#endif
+
 /*************************** Variable Definitions *****************************/
 
 XIntc       intc;               // Interrupt controller
 XEmacLite   ether;              // Ethernet
 
-u8 extInputArrivalPtr = 0;      // Next message arrival slot
-u8 extInputProcessPtr = 0;      // Next message to process
+ReceiveRing extInputRing = {0, 0, 0};   // The slots of rawExternalInput
 u8 externalOutput[XEL_HEADER_SIZE + (MAX_CMD_LEN * MAX_OUTPUT_CMDS * 4)];
+#ifdef FRAME_BATCHING
+u8 rawExternalInput[EXT_INPUT_SIZE][XEL_MAX_FRAME_SIZE];
+int externalOutputIndex = XEL_HEADER_SIZE;  // The end of the commands so far
+#else
 u8 rawExternalInput[EXT_INPUT_SIZE][XEL_HEADER_SIZE + (MAX_CMD_LEN * MAX_INPUT_CMDS * 4)];
+#endif
 u32 externalInput[MAX_CMD_LEN * MAX_INPUT_CMDS];
 
+#ifdef EVENT_DRIVEN_LOOP
+volatile bool channelDataExists[FSL_CHANNEL_COUNT];    // Set by interrupts
+u32 nextChannel = 0;                   // The channel to service first
+#endif
+
 // Setup other variables
 #ifdef MASTER_IS_RESIDENT
 int timeStep = 0;
 u32 boidCount = 0;              // Number of simulation boids
-u8 channelSetupCounter = 1;
 u8 discoveredBoidCPUCount = 0;
-static u8 channelIDList[RESIDENT_BOIDCPU_COUNT + 1];
-#else
-u8 channelSetupCounter = 0;
-static u8 channelIDList[RESIDENT_BOIDCPU_COUNT];
 #endif
+u8 channelSetupCounter = FIRST_BOIDCPU_CHANNEL;
+static u8 channelIDList[FSL_CHANNEL_COUNT];     // BoidCPU ID by channel
 
 #ifdef ACT_AS_BOIDGPU
+#ifdef ASYNC_TIME_STEPS
+// Number of drawn boids for each time step in the window starting at timeStep
+int drawnBoidsCount[STEP_WINDOW];
+#else
 int drawnBoidsCount = 0;        // Number of drawn boids
 #endif
+#endif
 
 // If the BoidMaster is present, then it must be on channel 0
 
@@ -126,15 +190,49 @@ bool boidCPUsSetup = false;
 bool fowardMessage = true;
 bool forwardingInterceptedSetup = false;
 u8 ackCount = 0;
+u32 ackType = 0;                // The type of the ACKs being collected
+u32 ackRebuildFlag = 0;         // OR of the neighbour list rebuild ACK flags
+
+#ifdef ACK_TREE
+u32 ackParentID = CONTROLLER_ID;    // Where the combined ACK is sent
+u8 ackChildCount = 0;           // Child Gatekeepers in the ACK tree
+u32 ackBoidCount = 0;           // Boids in this part of the ACK tree
+u32 ackMaxLoad = 0;             // Largest BoidCPU boid count in this part
+u32 ackBoidCPUCount = 0;        // BoidCPUs in this part of the ACK tree
+#endif
 
+#ifdef ROUTING_TABLE
+// The channel of each resident BoidCPU, indexed by BoidCPU ID. Non-resident 
+// IDs hold ALL_BOIDCPU_CHANNELS. The neighbours of the resident BoidCPUs are 
+// held as a bitmap, also indexed by BoidCPU ID. 
+u8 routingTable[ROUTING_TABLE_SIZE];
+u32 residentNbrBitmap[ROUTING_TABLE_SIZE / 32];
+#else
 u8 residentNbrCounter = 0;
 u8 residentBoidCPUNeighbours[MAX_BOIDCPU_NEIGHBOURS * RESIDENT_BOIDCPU_COUNT];
+#endif
+
+#ifdef MAC_LEARNING
+// The MAC addresses of the FPGAs that the BoidMaster, Gatekeepers and 
+// BoidCPUs on other FPGAs are on, learnt from the frames received. Indexed by 
+// ID, which covers the 8-bit BoidCPU IDs and Gatekeeper IDs such as the 
+// default of 999. The IDs that have been learnt are held as a bitmap. 
+u8 macTable[MAC_TABLE_SIZE][XEL_MAC_ADDR_SIZE];
+u32 macKnownBitmap[MAC_TABLE_SIZE / 32];
+#endif
 
 /*************************** Function Prototypes ******************************/
 int setupEthernet();
 
 static void EmacLiteRecvHandler(void *CallBackRef);
 static void EmacLiteSendHandler(void *CallBackRef);
+#ifdef EVENT_DRIVEN_LOOP
+static void FSLDataHandler(void *CallBackRef);
+int otherEventWaiting(void);
+int channelSignalled(u32 channel);
+int readChannel(u32 channel, u32 *data);
+void channelDrained(u32 channel);
+#endif
 
 void registerWithSwitch();
 void checkForInput();
@@ -143,16 +241,29 @@ void respondToPing();
 void interceptSetupInfo(u32 *interceptedData);
 
 u8 internalChannelLookUp(u32 to);
+#ifdef ROUTING_TABLE
+void initialiseRoutingTable();
+bool residentNeighbour(u32 id);
+#endif
 u8 recipientLookUp(u32 to, u32 from);
 bool externalMessageRelevant();
 void interceptMessage(u32 *data);
 
 void processReceivedExternalMessage();
+void processExternalCommand();
 void processReceivedInternalMessage(u32 *inputData);
+void collectAck(u32 *ackData);
 
 void sendMessage(u32 len, u32 to, u32 from, u32 type, u32 *data);
 void sendInternalMessage(u32 len, u32 to, u32 from, u32 type, u32 *data);
 void sendExternalMessage(u32 len, u32 to, u32 from, u32 type, u32 *data);
+#ifdef FRAME_BATCHING
+void flushExternalFrame();
+#endif
+#ifdef MAC_LEARNING
+void learnMacAddress(u32 id, u8 *mac);
+u8 *macAddressLookUp(u32 to);
+#endif
 
 void decodeAndPrintBoids(u32 *data);
 
@@ -173,9 +284,13 @@ void simulateBoidGPUACK();
 
 void putFSLData(u32 value, u32 channel);
 u32 getFSLData(u32 *data, u32 channel);
+u32 getFSLWord(u32 channel, int *invalid, int *error);
 
-void encodeEthernetMessage(u32 outputValue, u8* outputArrayPointer, int* idx);
-u32 decodeEthernetMessage(u8 inputZero, u8 inputOne, u8 inputTwo, u8 inputThree);
+#ifdef EVENT_DRIVEN_LOOP
+// The events waited on by checkForInput(), signalled by the interrupt handlers
+static const EventSource fslEvents = {otherEventWaiting, channelSignalled,
+        readChannel, channelDrained, processReceivedInternalMessage};
+#endif
 
 
 //============================================================================//
@@ -212,6 +327,9 @@ int main() {
     // TODO: Assign MAC address and ID randomly, or better
 
     setupEthernet();
+#ifdef ROUTING_TABLE
+    initialiseRoutingTable();
+#endif
     registerWithSwitch();
 
     do {
@@ -272,48 +390,123 @@ int main() {
  * The main method used to determine if there is any input available on either
  * internal or external lines. If there is, it is processed accordingly.
  *
+ * If FRAME_BATCHING is defined, the commands sent externally while processing 
+ * the input are collected into as few Ethernet frames as possible and any 
+ * partly-filled frame is sent at the end of each pass. 
+ *
+ * If EVENT_DRIVEN_LOOP is defined, the FSL channels are not polled. Instead, 
+ * the Gatekeeper waits until an interrupt signals that there is data on a 
+ * channel or in the Ethernet receive ring (or a key has been pressed) and 
+ * then only reads the channels that have data (see eventSource.h). The wait 
+ * spins, so this saves FSL reads rather than processor time. 
+ *
  * @param   None
  *
  * @return  None
  *
  ******************************************************************************/
 void checkForInput() {
+#ifdef EVENT_DRIVEN_LOOP
+    waitForEvents(&fslEvents, FSL_CHANNEL_COUNT);
+#endif
+
     // Check for and process received external data ----------------------------
-    if (extInputProcessPtr != extInputArrivalPtr) {
+    int extInputCounter = 0;
+    while (!receiveRingEmpty(&extInputRing) &&
+            (extInputCounter < EXT_INPUTS_PER_PASS)) {
 #ifdef DEBUG
         print("External messages ready to be processed\n\r");
 #endif
         processReceivedExternalMessage();
+        extInputCounter++;
     }
 
     // Check for internal (FXL/AXI) data ---------------------------------------
-#ifdef MASTER_IS_RESIDENT
-    u32 boidMasterData[MAX_CMD_LEN];
-    int boidMasterInvalid = getFSLData(boidMasterData, BOIDMASTER_CHANNEL);
+#ifdef EVENT_DRIVEN_LOOP
+    u32 internalData[MAX_CMD_LEN];
+    nextChannel = serviceChannels(&fslEvents, FSL_CHANNEL_COUNT, CHANNEL_QUOTA,
+            nextChannel, internalData);
+#else
+    u32 internalData[MAX_CMD_LEN];
+    u32 channel = 0;
+    for (channel = 0; channel < FSL_CHANNEL_COUNT; channel++) {
+        if (!getFSLData(internalData, channel)) {
+            processReceivedInternalMessage(internalData);
+        }
+    }
 #endif
 
-    u32 boidCPUChannelOneData[MAX_CMD_LEN];
-    int boidCPUChannelOneInvalid = getFSLData(boidCPUChannelOneData, BOIDCPU_CHANNEL_1);
-
-    u32 boidCPUChannelTwoData[MAX_CMD_LEN];
-    int boidCPUChannelTwoInvalid = getFSLData(boidCPUChannelTwoData, BOIDCPU_CHANNEL_2);
+#ifdef FRAME_BATCHING
+    // Send the commands bound off-chip during this pass
+    flushExternalFrame();
+#endif
+}
 
-    // Process received internal data ------------------------------------------
+#ifdef EVENT_DRIVEN_LOOP
+/******************************************************************************/
+/*
+ * Checks for the events, other than FSL data, that checkForInput() handles: a 
+ * received Ethernet frame or, if the BoidMaster is resident, a key press. The 
+ * UART is not interrupt driven, so it is read directly. 
+ *
+ * @param   None
+ *
+ * @return          1 if there is an event waiting, 0 otherwise
+ *
+ ******************************************************************************/
+int otherEventWaiting(void) {
 #ifdef MASTER_IS_RESIDENT
-    if (!boidMasterInvalid) {
-        processReceivedInternalMessage(boidMasterData);
+    if (!XUartLite_IsReceiveEmpty(XPAR_RS232_UART_1_BASEADDR)) {
+        return 1;
     }
 #endif
 
-    if (!boidCPUChannelOneInvalid) {
-        processReceivedInternalMessage(boidCPUChannelOneData);
-    }
+    return !receiveRingEmpty(&extInputRing);
+}
 
-    if (!boidCPUChannelTwoInvalid) {
-        processReceivedInternalMessage(boidCPUChannelTwoData);
-    }
+/******************************************************************************/
+/*
+ * Checks whether the FSL data interrupt of a channel has fired. 
+ *
+ * @param   channel The FSL channel to check
+ *
+ * @return          1 if the channel has signalled data, 0 otherwise
+ *
+ ******************************************************************************/
+int channelSignalled(u32 channel) {
+    return channelDataExists[channel];
+}
+
+/******************************************************************************/
+/*
+ * Reads a message from an FSL channel. 
+ *
+ * @param   channel The FSL channel to read from
+ * @param   data    The array to store the message in
+ *
+ * @return          1 if a message was read, 0 if the channel was empty
+ *
+ ******************************************************************************/
+int readChannel(u32 channel, u32 *data) {
+    return !getFSLData(data, channel);
 }
 
+/******************************************************************************/
+/*
+ * Clears the data flag of an empty FSL channel and enables its interrupt 
+ * again, so that the next message to arrive on it is signalled. 
+ *
+ * @param   channel The FSL channel that is empty
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void channelDrained(u32 channel) {
+    channelDataExists[channel] = false;
+    XIntc_Enable(&intc, FSL_INTERRUPT_ID(channel));
+}
+#endif
+
 //============================================================================//
 //- Message Reception Functions ----------------------------------------------//
 //============================================================================//
@@ -325,6 +518,11 @@ void checkForInput() {
  * the Gatekeeper and if it is boids heading to the BoidCPU starting counting 
  * until all the system boids have been received. Then issue an ACK. 
  * 
+ * If ASYNC_TIME_STEPS is defined, the BoidCPUs may be drawing different time 
+ * steps at once. The boids are counted against the time step that each 
+ * message is tagged with (the last word of its body) and the time steps are 
+ * ACKed in order.
+ * 
  * @param   None
  *
  * @return  None
@@ -332,12 +530,23 @@ void checkForInput() {
  ******************************************************************************/
 void monitorDrawnBoids(u32* data) {
     if (data[CMD_TYPE] == CMD_DRAW_INFO) {
+#ifdef ASYNC_TIME_STEPS
+        u32 slot = data[data[CMD_LEN] - 1] % STEP_WINDOW;
+        drawnBoidsCount[slot] += (data[CMD_LEN] - CMD_HEADER_LEN - 1) /
+                BOID_DATA_LENGTH;
+
+        while (drawnBoidsCount[timeStep % STEP_WINDOW] == boidCount) {
+            drawnBoidsCount[timeStep % STEP_WINDOW] = 0;
+            simulateBoidGPUACK();
+        }
+#else
         drawnBoidsCount +=  (data[CMD_LEN] - CMD_HEADER_LEN - 1) / BOID_DATA_LENGTH;
 
         if (drawnBoidsCount == boidCount) {
             drawnBoidsCount = 0;
             simulateBoidGPUACK();
         }
+#endif
     }
 }
 
@@ -392,21 +601,7 @@ void processReceivedInternalMessage(u32 *inputData) {
     // Collect the ACKs for the recipient BoidCPUs and issue a collective one
     if (inputData[CMD_TYPE] == CMD_ACK) {
         fowardMessage = false;
-        ackCount++;
-
-        if (ackCount == RESIDENT_BOIDCPU_COUNT) {
-#ifdef DEBUG
-            print ("All ACKs received \n\r");
-#endif
-            sendMessage(0, CONTROLLER_ID, gatekeeperID, CMD_ACK, messageData);
-            ackCount = 0;
-        }
-#ifdef DEBUG
-        else {
-            xil_printf("Waiting for ACKs (received %d of %d)...\n\r", ackCount,
-                    RESIDENT_BOIDCPU_COUNT);
-        }
-#endif
+        collectAck(inputData);
     }
 #ifdef ACT_AS_BOIDGPU
     else if (inputData[CMD_TO] == BOIDGPU_ID) {
@@ -414,18 +609,99 @@ void processReceivedInternalMessage(u32 *inputData) {
     }
 #endif
 
-    // Forward the message, if needed
+    // Forward the message, if needed, sending the body from where it is
     if (fowardMessage) {
-        u32 inputDataBodyLength = inputData[CMD_LEN] - CMD_HEADER_LEN;
-        u32 inputDataBody[inputDataBodyLength];
-        int i = 0;
-        for (i = 0; i < inputDataBodyLength; i++) {
-            inputDataBody[i] = inputData[CMD_HEADER_LEN + i];
-        }
+        sendMessage(inputData[CMD_LEN] - CMD_HEADER_LEN, inputData[CMD_TO],
+                inputData[CMD_FROM], inputData[CMD_TYPE],
+                &inputData[CMD_HEADER_LEN]);
+    }
+}
+
+/******************************************************************************/
+/*
+ * Collect an ACK from a resident BoidCPU and, once all of the resident 
+ * BoidCPUs have ACKed, issue a collective ACK to the BoidMaster. The 
+ * collective ACK has no body unless NBR_LIST_CACHING or ACK_TREE is defined, 
+ * in which case it carries the type of the ACKs (as given by the first ACK) 
+ * and whether any of the BoidCPUs need their neighbour lists rebuilt. 
+ * 
+ * If ACK_TREE is defined, the Gatekeepers form a tree (as set by the 
+ * BoidMaster's CMD_ACK_TREE message) and a Gatekeeper also waits for the ACKs 
+ * of its child Gatekeepers before sending the collective ACK to its parent. 
+ * The collective ACK also carries the boid count, the largest BoidCPU boid 
+ * count and the BoidCPU count of the Gatekeeper's subtree. Until the tree 
+ * message is received, a Gatekeeper has no children and ACKs the BoidMaster. 
+ * The Gatekeepers must have distinct IDs for the tree to be used.
+ * 
+ * @param   ackData     The ACK from a BoidCPU or child Gatekeeper
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void collectAck(u32 *ackData) {
+    ackCount++;
+
+    if (ackCount == 1) {
+        ackType = ackData[CMD_HEADER_LEN + 0];
+    }
+
+    if (ackData[CMD_LEN] > CMD_HEADER_LEN + CMD_ACK_RBLD_IDX) {
+        ackRebuildFlag |= ackData[CMD_HEADER_LEN + CMD_ACK_RBLD_IDX];
+    }
+
+#ifdef ACK_TREE
+    u32 load = 0;
+    if (ackData[CMD_LEN] > CMD_HEADER_LEN + CMD_ACK_CPUCNT_IDX) {
+        // The collective ACK of a child Gatekeeper
+        ackBoidCount += ackData[CMD_HEADER_LEN + CMD_ACK_BDCNT_IDX];
+        ackBoidCPUCount += ackData[CMD_HEADER_LEN + CMD_ACK_CPUCNT_IDX];
+        load = ackData[CMD_HEADER_LEN + CMD_ACK_LOAD_IDX];
+    } else if (ackData[CMD_LEN] > CMD_HEADER_LEN + CMD_ACK_BDCNT_IDX) {
+        // The ACK of a resident BoidCPU
+        ackBoidCount += ackData[CMD_HEADER_LEN + CMD_ACK_BDCNT_IDX];
+        ackBoidCPUCount++;
+        load = ackData[CMD_HEADER_LEN + CMD_ACK_BDCNT_IDX];
+    }
 
-        sendMessage(inputDataBodyLength, inputData[CMD_TO],
-                inputData[CMD_FROM], inputData[CMD_TYPE], inputDataBody);
+    if (load > ackMaxLoad) {
+        ackMaxLoad = load;
+    }
+
+    u8 expectedAckCount = RESIDENT_BOIDCPU_COUNT + ackChildCount;
+#else
+    u8 expectedAckCount = RESIDENT_BOIDCPU_COUNT;
+#endif
+
+    if (ackCount == expectedAckCount) {
+#ifdef DEBUG
+        print ("All ACKs received \n\r");
+#endif
+        messageData[0] = ackType;
+        messageData[CMD_ACK_RBLD_IDX] = ackRebuildFlag;
+#ifdef ACK_TREE
+        messageData[CMD_ACK_BDCNT_IDX] = ackBoidCount;
+        messageData[CMD_ACK_LOAD_IDX] = ackMaxLoad;
+        messageData[CMD_ACK_CPUCNT_IDX] = ackBoidCPUCount;
+        sendMessage(CMD_ACK_CPUCNT_IDX + 1, ackParentID, gatekeeperID, CMD_ACK,
+                messageData);
+        ackBoidCount = 0;
+        ackMaxLoad = 0;
+        ackBoidCPUCount = 0;
+#elif defined(NBR_LIST_CACHING)
+        sendMessage(CMD_ACK_RBLD_IDX + 1, CONTROLLER_ID, gatekeeperID, CMD_ACK,
+                messageData);
+#else
+        sendMessage(0, CONTROLLER_ID, gatekeeperID, CMD_ACK, messageData);
+#endif
+        ackCount = 0;
+        ackRebuildFlag = 0;
     }
+#ifdef DEBUG
+    else {
+        xil_printf("Waiting for ACKs (received %d of %d)...\n\r", ackCount,
+                expectedAckCount);
+    }
+#endif
 }
 
 /******************************************************************************/
@@ -435,24 +711,76 @@ void processReceivedInternalMessage(u32 *inputData) {
  * representation to a 32-bit representation, which is used internally. The 
  * message is then printed, parsed and forwarded as necessary. 
  * 
+ * If FRAME_BATCHING is defined, an Ethernet frame can hold several commands, 
+ * one after the other and ended by a zero length or the end of the frame. The 
+ * commands are split out and processed in the order they were sent. 
+ * 
  * @param   None
  *
  * @return  None
  *
  ******************************************************************************/
 void processReceivedExternalMessage() {
-    // Move the message and strip the header
-    int j = 0, k = 0;
-    for (j = XEL_HEADER_SIZE, k = 0; j < (MAX_CMD_LEN * MAX_INPUT_CMDS); j+=4, k++) {
-        externalInput[k] = decodeEthernetMessage(
-                rawExternalInput[extInputProcessPtr][j + 0],
-                rawExternalInput[extInputProcessPtr][j + 1],
-                rawExternalInput[extInputProcessPtr][j + 2],
-                rawExternalInput[extInputProcessPtr][j + 3]);
+#ifdef FRAME_BATCHING
+    XEmacLite_FlushReceive(&ether); // Clear any received messages
+
+    u8 *frame = rawExternalInput[extInputRing.processPtr];
+    int j = XEL_HEADER_SIZE;
+    while ((j + 4) <= MAX_FRAME_SIZE) {
+        u32 length = 0;
+        decodeEthernetWords(&frame[j], 1, &length);
+
+        // A zero length, or one that cannot be right, ends the commands
+        if ((length < CMD_HEADER_LEN) || (length > MAX_CMD_LEN) ||
+                ((j + (length * 4)) > MAX_FRAME_SIZE)) {
+            break;
+        }
+
+        decodeEthernetWords(&frame[j], length, externalInput);
+        j += length * 4;
+
+        processExternalCommand();
+    }
+#else
+    // Move the message and strip the header, decoding only the command
+    u8 *frame = rawExternalInput[extInputRing.processPtr];
+    u32 length = 0;
+    decodeEthernetWords(&frame[XEL_HEADER_SIZE], 1, &length);
+
+    bool lengthValid = (length >= CMD_HEADER_LEN) && (length <= MAX_CMD_LEN);
+    if (lengthValid) {
+        decodeEthernetWords(&frame[XEL_HEADER_SIZE], length, externalInput);
     }
 
     XEmacLite_FlushReceive(&ether); // Clear any received messages
 
+    if (lengthValid) {
+        processExternalCommand();
+    }
+#endif
+
+    receiveRingRelease(&extInputRing, EXT_INPUT_SIZE);
+}
+
+/******************************************************************************/
+/*
+ * Process a command received from another FPGA, once it has been decoded into 
+ * externalInput. If the BoidCPUs are not yet setup, the command is checked 
+ * for setup information, else it is forwarded if it is relevant to the 
+ * resident BoidCPUs or the BoidMaster. 
+ * 
+ * @param   None
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void processExternalCommand() {
+#ifdef MAC_LEARNING
+    // Remember the FPGA that the sender is on so messages to it are unicast
+    learnMacAddress(externalInput[CMD_FROM],
+            &rawExternalInput[extInputRing.processPtr][XEL_MAC_ADDR_SIZE]);
+#endif
+
 #ifdef ACT_AS_BOIDGPU
     monitorDrawnBoids(externalInput);
 #endif
@@ -482,20 +810,23 @@ void processReceivedExternalMessage() {
         decodeAndPrintBoids(externalInput);
 #endif
 
-        // Forward the message
-        u32 dataBodyLength = externalInput[CMD_LEN] - CMD_HEADER_LEN;
-        u32 dataBody[dataBodyLength];
-        int i = 0;
-        for (i = 0; i < dataBodyLength; i++) {
-            dataBody[i] = externalInput[CMD_HEADER_LEN + i];
+        fowardMessage = true;
+#ifdef ACK_TREE
+        // Combine the ACKs of child Gatekeepers rather than forwarding them
+        if ((externalInput[CMD_TO] == gatekeeperID) &&
+                (externalInput[CMD_TYPE] == CMD_ACK)) {
+            fowardMessage = false;
+            collectAck(externalInput);
         }
+#endif
 
-        sendMessage(dataBodyLength, externalInput[CMD_TO],
-                externalInput[CMD_FROM], externalInput[CMD_TYPE], dataBody);
+        // Forward the message, if needed, sending the body from where it is
+        if (fowardMessage) {
+            sendMessage(externalInput[CMD_LEN] - CMD_HEADER_LEN,
+                    externalInput[CMD_TO], externalInput[CMD_FROM],
+                    externalInput[CMD_TYPE], &externalInput[CMD_HEADER_LEN]);
+        }
     }
-
-
-    extInputProcessPtr = (extInputProcessPtr + 1) % EXT_INPUT_SIZE;
 }
 
 //============================================================================//
@@ -579,37 +910,45 @@ void sendInternalMessage(u32 len, u32 to, u32 from, u32 type, u32 *data) {
         channel = internalChannelLookUp(to);
     }
 
-    // First, create the message
-    u32 command[MAX_CMD_LEN];
+    // First, create the message header. The body is sent from where it is.
+    u32 header[CMD_HEADER_LEN];
     int i = 0, j = 0;
 
-    command[CMD_LEN] = len + CMD_HEADER_LEN;
-    command[CMD_TO] = to;
-    command[CMD_FROM] = from;
-    command[CMD_TYPE] = type;
+    header[CMD_LEN] = len + CMD_HEADER_LEN;
+    header[CMD_TO] = to;
+    header[CMD_FROM] = from;
+    header[CMD_TYPE] = type;
 
-    if (len > 0) {
-        for (i = 0; i < len; i++) {
-            command[CMD_HEADER_LEN + i] = data[i];
-        }
+#ifdef DEBUG
+    u32 command[MAX_CMD_LEN];
+    for (i = 0; i < CMD_HEADER_LEN; i++) {
+        command[i] = header[i];
+    }
+    for (i = 0; i < len; i++) {
+        command[CMD_HEADER_LEN + i] = data[i];
     }
+#endif
 
     // Multicast messages - don't send back to self
-    // For each channel, if the multicast message is not from that channel then
-    // send the message down that channel.
+    // Send the message down each BoidCPU channel except that of the sender
     if (to == CMD_MULTICAST) {
-#ifdef MASTER_IS_RESIDENT
-        for (i = 1; i < (RESIDENT_BOIDCPU_COUNT + 1); i++) {
-#else
-        for (i = 0; i < RESIDENT_BOIDCPU_COUNT; i++) {
-#endif
-            if (channelIDList[i] != from) {
+        u32 channelMask = BOIDCPU_CHANNEL_MASK;
+        u8 senderChannel = internalChannelLookUp(from);
+        if (senderChannel != ALL_BOIDCPU_CHANNELS) {
+            channelMask &= ~(1u << senderChannel);
+        }
+
+        for (i = FIRST_BOIDCPU_CHANNEL; i < FSL_CHANNEL_COUNT; i++) {
+            if (channelMask & (1u << i)) {
 #ifdef DEBUG
                 print("INTERNAL: ");
                 printMessage(true, command);
 #endif
-                for (j = 0; j < CMD_HEADER_LEN + len; j++) {
-                    putFSLData(command[j], i);
+                for (j = 0; j < CMD_HEADER_LEN; j++) {
+                    putFSLData(header[j], i);
+                }
+                for (j = 0; j < len; j++) {
+                    putFSLData(data[j], i);
                 }
             }
         }
@@ -619,25 +958,18 @@ void sendInternalMessage(u32 len, u32 to, u32 from, u32 type, u32 *data) {
         printMessage(true, command);
 #endif
 
-        // Finally, send the message
+        // Finally, send the message, to all BoidCPU channels if the recipient 
+        // does not have a channel of its own
         for (i = 0; i < CMD_HEADER_LEN + len; i++) {
-            switch (channel) {
-#ifdef MASTER_IS_RESIDENT
-            case BOIDMASTER_CHANNEL:
-                putFSLData(command[i], BOIDMASTER_CHANNEL);
-                break;
-#endif
-            case BOIDCPU_CHANNEL_1:
-                putFSLData(command[i], BOIDCPU_CHANNEL_1);
-                break;
-            case BOIDCPU_CHANNEL_2:
-                putFSLData(command[i], BOIDCPU_CHANNEL_2);
-                break;
-            default:
-                // Otherwise, send to all BoidCPU channels
-                putFSLData(command[i], BOIDCPU_CHANNEL_1);
-                putFSLData(command[i], BOIDCPU_CHANNEL_2);
-                break;
+            u32 word = (i < CMD_HEADER_LEN) ? header[i] :
+                    data[i - CMD_HEADER_LEN];
+
+            if (channel < FSL_CHANNEL_COUNT) {
+                putFSLData(word, channel);
+            } else {
+                for (j = FIRST_BOIDCPU_CHANNEL; j < FSL_CHANNEL_COUNT; j++) {
+                    putFSLData(word, j);
+                }
             }
         }
     }
@@ -648,6 +980,11 @@ void sendInternalMessage(u32 len, u32 to, u32 from, u32 type, u32 *data) {
  * Sends a message to an external entity beyond the FPGA that the MicroBlaze
  * resides on. Ethernet is used to transmit the messages to other FPGAs.
  *
+ * If FRAME_BATCHING is defined, the message is added to the frame being built 
+ * instead, which is sent when it is full, at the end of the current 
+ * checkForInput() pass or, to keep barrier latency low, straight away if the 
+ * message is an ACK or a broadcast (such as a BoidMaster phase change). 
+ *
  * @param   len     The length of the message body
  * @param   to      The ID of the recipient of the message
  * @param   from    The ID of the message sender
@@ -658,18 +995,43 @@ void sendInternalMessage(u32 len, u32 to, u32 from, u32 type, u32 *data) {
  *
  ******************************************************************************/
 void sendExternalMessage(u32 len, u32 to, u32 from, u32 type, u32 *data) {
+    int i = 0;
+
+    // The destination MAC address, broadcast unless the recipient's is known
+#ifdef MAC_LEARNING
+    u8 *destination = macAddressLookUp(to);
+
+    // A BoidCPU is on the FPGA of the Gatekeeper that its setup is sent to
+    if ((type == CMD_SIM_SETUP) && (destination != broadcast_mac_address)) {
+        learnMacAddress(data[CMD_SETUP_NEWID_IDX], destination);
+    }
+#else
+    u8 *destination = broadcast_mac_address;
+#endif
+
+#ifdef FRAME_BATCHING
+    // Send the frame being built first if the message will not fit in it or 
+    // if the frame is going somewhere else
+    bool sameDestination = true;
+    for (i = 0; i < XEL_MAC_ADDR_SIZE; i++) {
+        if (externalOutput[i] != destination[i]) {
+            sameDestination = false;
+        }
+    }
+
+    if (((externalOutputIndex + ((len + CMD_HEADER_LEN) * 4)) > MAX_FRAME_SIZE)
+            || (!sameDestination)) {
+        flushExternalFrame();
+    }
+#endif
+
     // First, create the Ethernet message header
-    // The destination MAC address, broadcast here
     u8 *buffer = externalOutput;
-    *buffer++ = 0xFF;
-    *buffer++ = 0xFF;
-    *buffer++ = 0xFF;
-    *buffer++ = 0xFF;
-    *buffer++ = 0xFF;
-    *buffer++ = 0xFF;
+    for (i = 0; i < XEL_MAC_ADDR_SIZE; i++) {
+        *buffer++ = destination[i];
+    }
 
     // The source MAC address
-    int i = 0;
     for (i = 0; i < XEL_MAC_ADDR_SIZE; i++) {
         *buffer++ = own_mac_address[i];
     }
@@ -681,24 +1043,25 @@ void sendExternalMessage(u32 len, u32 to, u32 from, u32 type, u32 *data) {
     // The internal messages are 32 bits in size, whereas Ethernet is 8 bits.
     // A simple solution is to split the messages up on sending into 8 bit
     // pieces and join back together on receiving.
+#ifdef FRAME_BATCHING
+    int index = externalOutputIndex;
+#else
     int index = 14;
-    encodeEthernetMessage((len + CMD_HEADER_LEN), externalOutput, &index);
-    encodeEthernetMessage(to, externalOutput, &index);
-    encodeEthernetMessage(from, externalOutput, &index);
-    encodeEthernetMessage(type, externalOutput, &index);
-
-    if (len > 0) {
-        for (i = 0; i < len; i++) {
-            encodeEthernetMessage(data[i], externalOutput, &index);
-        }
-    }
+#endif
+    u32 header[CMD_HEADER_LEN] = {len + CMD_HEADER_LEN, to, from, type};
+    encodeEthernetWords(header, CMD_HEADER_LEN, externalOutput, &index);
+    encodeEthernetWords(data, len, externalOutput, &index);
 
-    const int minEthernetMsgSize = 64;
+#ifdef FRAME_BATCHING
+    externalOutputIndex = index;
+#else
+    const int minEthernetMsgSize = MIN_FRAME_SIZE;
     int paddedBytes = minEthernetMsgSize - (((len + CMD_HEADER_LEN) * 4) + XEL_HEADER_SIZE);
     int extraByteCounter = 0;
     for (extraByteCounter = 0; extraByteCounter < paddedBytes; extraByteCounter++) {
         externalOutput[index + extraByteCounter] = 0;
     }
+#endif
 
     // Then create the data to send, create the message
 #ifdef DEBUG
@@ -719,6 +1082,12 @@ void sendExternalMessage(u32 len, u32 to, u32 from, u32 type, u32 *data) {
     printMessage(true, command);
 #endif
 
+#ifdef FRAME_BATCHING
+    // Send barrier messages straight away
+    if ((type == CMD_ACK) || (to == CMD_BROADCAST)) {
+        flushExternalFrame();
+    }
+#else
     // Finally, clear the receive buffer before sending
     // XEmacLite_FlushReceive(&ether);
     int status = XEmacLite_Send(&ether, externalOutput, extraByteCounter + XEL_HEADER_SIZE + ((len + CMD_HEADER_LEN) * 4));
@@ -730,8 +1099,97 @@ void sendExternalMessage(u32 len, u32 to, u32 from, u32 type, u32 *data) {
         print("External message sent successfully \n\r");
     }
 #endif
+#endif
+}
+
+#ifdef FRAME_BATCHING
+/******************************************************************************/
+/*
+ * Sends the Ethernet frame being built by sendExternalMessage(), if it holds 
+ * any messages. If there is space, a zero length is added after the last 
+ * message so that the receiver knows where the messages end, then the frame 
+ * is padded to the minimum frame size. 
+ *
+ * @param   None
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void flushExternalFrame() {
+    if (externalOutputIndex == XEL_HEADER_SIZE) {
+        return;
+    }
+
+    if ((externalOutputIndex + 4) <= MAX_FRAME_SIZE) {
+        encodeEthernetMessage(0, externalOutput, &externalOutputIndex);
+    }
+
+    while (externalOutputIndex < MIN_FRAME_SIZE) {
+        externalOutput[externalOutputIndex++] = 0;
+    }
+
+    int status = XEmacLite_Send(&ether, externalOutput, externalOutputIndex);
+    externalOutputIndex = XEL_HEADER_SIZE;
+
+#ifdef DEBUG
+    if (status == 1) {
+        print("**** Failed to send external frame\n\r");
+    } else {
+        print("External frame sent successfully \n\r");
+    }
+#endif
+}
+#endif
+
+#ifdef MAC_LEARNING
+/******************************************************************************/
+/*
+ * Records the MAC address of the FPGA that an ID is on, replacing any address 
+ * already held for the ID. IDs of MAC_TABLE_SIZE or more are not recorded and 
+ * messages to them continue to be broadcast. Neither is the shared Gatekeeper 
+ * ID, as it does not identify a single FPGA. 
+ *
+ * @param   id      The ID of the BoidMaster, a Gatekeeper or a BoidCPU
+ * @param   mac     The MAC address of the FPGA that the ID is on
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void learnMacAddress(u32 id, u8 *mac) {
+    int i = 0;
+
+    if ((id >= MAC_TABLE_SIZE) || (id == SHARED_GATEKEEPER_ID)) {
+        return;
+    }
+
+    for (i = 0; i < XEL_MAC_ADDR_SIZE; i++) {
+        macTable[id][i] = mac[i];
+    }
+    macKnownBitmap[id / 32] |= (1u << (id % 32));
 }
 
+/******************************************************************************/
+/*
+ * Determines the destination MAC address of a message sent to another FPGA. 
+ * Broadcast and multicast messages, and messages to an ID whose MAC address 
+ * has not been learnt, are sent to the broadcast MAC address. 
+ *
+ * @param   to      The ID of the recipient of the message
+ *
+ * @return          A pointer to the destination MAC address
+ *
+ ******************************************************************************/
+u8 *macAddressLookUp(u32 to) {
+    if ((to != CMD_BROADCAST) && (to != CMD_MULTICAST) &&
+            (to < MAC_TABLE_SIZE) &&
+            ((macKnownBitmap[to / 32] & (1u << (to % 32))) != 0)) {
+        return macTable[to];
+    }
+
+    return broadcast_mac_address;
+}
+#endif
+
 //============================================================================//
 //- Message Transceive Supporting Functions ----------------------------------//
 //============================================================================//
@@ -742,8 +1200,10 @@ void sendExternalMessage(u32 len, u32 to, u32 from, u32 type, u32 *data) {
  * ignored. It should be forwarded internally if:
  *  - it is from the BoidMaster
  *  - it is a broadcast command
+ *  - it is addressed directly to a resident BoidCPU
  *  - it is from a BoidCPU that is a neighbour of a resident BoidCPU
  *  - it is addressed to the BoidMaster AND the BoidMaster is resident
+ *  - it is an ACK from a child Gatekeeper, if ACK_TREE is defined
  *
  * @param   None
  *
@@ -770,13 +1230,33 @@ bool externalMessageRelevant() {
     }
 #endif
 
+#ifdef ACK_TREE
+    // The collective ACK of a child Gatekeeper in the ACK tree
+    else if ((externalInput[CMD_TO] == gatekeeperID) &&
+            (externalInput[CMD_TYPE] == CMD_ACK)) {
+        result = true;
+    }
+#endif
+
+    // A message addressed directly to a BoidCPU, e.g. a halo neighbour 
+    // exchange, is only relevant if that BoidCPU is resident
+    else if ((externalInput[CMD_TO] >= FIRST_BOIDCPU_ID) &&
+            (externalInput[CMD_TO] != CMD_MULTICAST)) {
+        result = (internalChannelLookUp(externalInput[CMD_TO]) !=
+                ALL_BOIDCPU_CHANNELS);
+    }
+
     else if (externalInput[CMD_FROM] >= FIRST_BOIDCPU_ID) {
+#ifdef ROUTING_TABLE
+        result = residentNeighbour(externalInput[CMD_FROM]);
+#else
         int i = 0;
         for (i = 0; i < residentNbrCounter; i++) {
             if (externalInput[CMD_FROM] == residentBoidCPUNeighbours[i]) {
                 result = true;
             }
         }
+#endif
     }
 
     return result;
@@ -796,8 +1276,10 @@ bool externalMessageRelevant() {
  ******************************************************************************/
 u8 recipientLookUp(u32 to, u32 from) {
     u8 recipientInterface;
+#ifndef ROUTING_TABLE
     bool intAndExt = false;
     int i = 0;
+#endif
 
     switch (to) {
         case CMD_BROADCAST:
@@ -821,11 +1303,15 @@ u8 recipientLookUp(u32 to, u32 from) {
             // If from resident, INTERNAL_AND_EXTERNAL_RECIPIENT;
             // Else INTERNAL_RECIPIENT;
 
-#ifdef MASTER_IS_RESIDENT
-            for (i = 1; i < (RESIDENT_BOIDCPU_COUNT + 1); i++) {
+#ifdef ROUTING_TABLE
+            if ((from >= FIRST_BOIDCPU_ID) &&
+                    (internalChannelLookUp(from) != ALL_BOIDCPU_CHANNELS)) {
+                recipientInterface = INTERNAL_AND_EXTERNAL_RECIPIENT;
+            } else {
+                recipientInterface = INTERNAL_RECIPIENT;
+            }
 #else
-            for (i = 0; i < RESIDENT_BOIDCPU_COUNT; i++) {
-#endif
+            for (i = FIRST_BOIDCPU_CHANNEL; i < FSL_CHANNEL_COUNT; i++) {
                 if (channelIDList[i] == from) {
                     recipientInterface = INTERNAL_AND_EXTERNAL_RECIPIENT;
                     intAndExt = true;
@@ -833,16 +1319,20 @@ u8 recipientLookUp(u32 to, u32 from) {
                 }
                 if (!intAndExt) recipientInterface = INTERNAL_RECIPIENT;
             }
+#endif
             break;
         default:
             if (to >= FIRST_BOIDCPU_ID) {
+#ifdef ROUTING_TABLE
+                if (internalChannelLookUp(to) != ALL_BOIDCPU_CHANNELS) {
+                    recipientInterface = INTERNAL_RECIPIENT;
+                } else {
+                    recipientInterface = EXTERNAL_RECIPIENT;
+                }
+#else
                 bool internal = false;
                 int i = 0;
-#ifdef MASTER_IS_RESIDENT
-                for (i = 1; i < (RESIDENT_BOIDCPU_COUNT + 1); i++) {
-#else
-                for (i = 0; i < RESIDENT_BOIDCPU_COUNT; i++) {
-#endif
+                for (i = FIRST_BOIDCPU_CHANNEL; i < FSL_CHANNEL_COUNT; i++) {
                     if (channelIDList[i] == to) {
                         recipientInterface = INTERNAL_RECIPIENT;
                         internal = true;
@@ -850,6 +1340,7 @@ u8 recipientLookUp(u32 to, u32 from) {
                     }
                 }
                 if(!internal) recipientInterface = EXTERNAL_RECIPIENT;
+#endif
 
             } else {
                 recipientInterface = INTERNAL_AND_EXTERNAL_RECIPIENT;
@@ -871,7 +1362,9 @@ u8 recipientLookUp(u32 to, u32 from) {
  * message is intercepted and the Gatekeeper responds on behalf of the
  * BoidCPUs. The BoidCPU setup information is intercepted in order for the
  * Gatekeeper to know the IDs of its resident BoidCPUs. A ping reply is
- * intercepted, if the BoidMaster is present, and outputted to the UI.
+ * intercepted, if the BoidMaster is present, and outputted to the UI. If 
+ * ACK_TREE is defined, the Gatekeeper's position in the ACK tree and any ACKs 
+ * from its child Gatekeepers are also intercepted.
  *
  * @param   interceptedData     The intercepted message/command
  *
@@ -888,6 +1381,18 @@ void interceptMessage(u32 *interceptedData) {
         interceptSetupInfo(interceptedData);
         forwardingInterceptedSetup = false;
     }
+#ifdef ACK_TREE
+    else if ((interceptedData[CMD_TO] == gatekeeperID)
+            && (interceptedData[CMD_TYPE] == CMD_ACK_TREE)) {
+        fowardMessage = false;
+        ackParentID = interceptedData[CMD_HEADER_LEN + CMD_TREE_PARENT_IDX];
+        ackChildCount = interceptedData[CMD_HEADER_LEN + CMD_TREE_CHILD_IDX];
+    } else if ((interceptedData[CMD_TO] == gatekeeperID)
+            && (interceptedData[CMD_TYPE] == CMD_ACK)) {
+        // A child Gatekeeper may ACK before all of the BoidCPUs here are setup
+        collectAck(interceptedData);
+    }
+#endif
 
 #ifdef MASTER_IS_RESIDENT
     // This should only ever be received from an external source
@@ -897,15 +1402,9 @@ void interceptMessage(u32 *interceptedData) {
         xil_printf("total (%d)..\n\r", discoveredBoidCPUCount);
 
         // Forward the data
-        int i = 0;
-        u32 dataBodyLength = interceptedData[CMD_LEN] - CMD_HEADER_LEN;
-        u32 dataBody[dataBodyLength];
-        for (i = 0; i < dataBodyLength; i++) {
-            dataBody[i] = interceptedData[CMD_HEADER_LEN + i];
-        }
-
-        sendMessage(dataBodyLength, interceptedData[CMD_TO],
-                interceptedData[CMD_FROM], interceptedData[CMD_TYPE], dataBody);
+        sendMessage(interceptedData[CMD_LEN] - CMD_HEADER_LEN,
+                interceptedData[CMD_TO], interceptedData[CMD_FROM],
+                interceptedData[CMD_TYPE], &interceptedData[CMD_HEADER_LEN]);
     }
 #endif
 }
@@ -960,7 +1459,17 @@ void interceptSetupInfo(u32 * setupData) {
             + CMD_SETUP_NEWID_IDX];
 
     // Update Gatekeeper's neighbour list
-    int i = 0, j = 0;
+    int i = 0;
+#ifdef ROUTING_TABLE
+    routingTable[channelIDList[channelSetupCounter]] = channelSetupCounter;
+
+    // Setting a bit that is already set leaves the neighbour listed once
+    for (i = 0; i < MAX_BOIDCPU_NEIGHBOURS; i++) {
+        u8 nbr = setupData[CMD_HEADER_LEN + CMD_SETUP_BNBRS_IDX + i];
+        residentNbrBitmap[nbr / 32] |= (1u << (nbr % 32));
+    }
+#else
+    int j = 0;
     for (i = 0; i < MAX_BOIDCPU_NEIGHBOURS; i++) {
         u8 nbr = setupData[CMD_HEADER_LEN + CMD_SETUP_BNBRS_IDX + i];
         bool neighbourAlreadyListed = false;
@@ -977,24 +1486,16 @@ void interceptSetupInfo(u32 * setupData) {
             residentNbrCounter++;
         }
     }
+#endif
 
     // Forward the data
-    u32 setupDataBodyLength = setupData[CMD_LEN] - CMD_HEADER_LEN;
-    u32 setupDataBody[setupDataBodyLength];
-    for (i = 0; i < setupDataBodyLength; i++) {
-        setupDataBody[i] = setupData[CMD_HEADER_LEN + i];
-    }
-
-    sendMessage(setupDataBodyLength, CMD_BROADCAST, setupData[CMD_FROM],
-            setupData[CMD_TYPE], setupDataBody);
+    sendMessage(setupData[CMD_LEN] - CMD_HEADER_LEN, CMD_BROADCAST,
+            setupData[CMD_FROM], setupData[CMD_TYPE],
+            &setupData[CMD_HEADER_LEN]);
 
     // Update counters
     channelSetupCounter++;
-#ifdef MASTER_IS_RESIDENT
-    if (channelSetupCounter == (RESIDENT_BOIDCPU_COUNT + 1)) {
-#else
-        if (channelSetupCounter == RESIDENT_BOIDCPU_COUNT) {
-#endif
+    if (channelSetupCounter == FSL_CHANNEL_COUNT) {
         boidCPUsSetup = true;
 #ifdef DEBUG
         print("BoidCPUs now set up\n\r");
@@ -1198,25 +1699,72 @@ void registerWithSwitch() {
  *
  ******************************************************************************/
 u8 internalChannelLookUp(u32 to) {
+#ifndef ROUTING_TABLE
     int i = 0;
+#endif
 
 #ifdef MASTER_IS_RESIDENT
     if (to == CONTROLLER_ID) {
         return BOIDMASTER_CHANNEL;
     }
+#endif
 
-    for (i = 1; i < (RESIDENT_BOIDCPU_COUNT + 1); i++) {
+#ifdef ROUTING_TABLE
+    if (to < ROUTING_TABLE_SIZE) {
+        return routingTable[to];
+    }
 #else
-        for (i = 0; i < RESIDENT_BOIDCPU_COUNT; i++) {
-#endif
+    for (i = FIRST_BOIDCPU_CHANNEL; i < FSL_CHANNEL_COUNT; i++) {
         if (channelIDList[i] == to) {
             return i;
         }
     }
+#endif
 
     return ALL_BOIDCPU_CHANNELS;    // e.g. on broadcast
 }
 
+#ifdef ROUTING_TABLE
+/******************************************************************************/
+/*
+ * Marks every BoidCPU ID as non-resident and not a neighbour. Channel 0 is a 
+ * valid BoidCPU channel when the BoidMaster is not resident, so the table 
+ * cannot be left zeroed. 
+ *
+ * @param   None
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void initialiseRoutingTable() {
+    int i = 0;
+    for (i = 0; i < ROUTING_TABLE_SIZE; i++) {
+        routingTable[i] = ALL_BOIDCPU_CHANNELS;
+    }
+
+    for (i = 0; i < (ROUTING_TABLE_SIZE / 32); i++) {
+        residentNbrBitmap[i] = 0;
+    }
+}
+
+/******************************************************************************/
+/*
+ * Determines whether a BoidCPU neighbours any of the resident BoidCPUs.
+ *
+ * @param   id      The ID of the BoidCPU
+ *
+ * @return          True if the BoidCPU is a neighbour, false otherwise
+ *
+ ******************************************************************************/
+bool residentNeighbour(u32 id) {
+    if (id >= ROUTING_TABLE_SIZE) {
+        return false;
+    }
+
+    return (residentNbrBitmap[id / 32] & (1u << (id % 32))) != 0;
+}
+#endif
+
 /******************************************************************************/
 /*
  * A wrapper for the getfsxl() method. Checks if there is any data on the
@@ -1230,19 +1778,8 @@ u8 internalChannelLookUp(u32 to) {
  *
  ******************************************************************************/
 u32 getFSLData(u32 *data, u32 channel) {
-    int invalid, error, value = 0;
-
-    if (channel == BOIDCPU_CHANNEL_1)
-        getfslx(value, BOIDCPU_CHANNEL_1, FSL_NONBLOCKING);
-    else if (channel == BOIDCPU_CHANNEL_2)
-        getfslx(value, BOIDCPU_CHANNEL_2, FSL_NONBLOCKING);
-#ifdef MASTER_IS_RESIDENT
-    else if (channel == BOIDMASTER_CHANNEL)
-        getfslx(value, BOIDMASTER_CHANNEL, FSL_NONBLOCKING);
-#endif
-
-    fsl_isinvalid(invalid);             // Was there any data?
-    fsl_iserror(error);                 // Was there an error?
+    int invalid, error;
+    u32 value = getFSLWord(channel, &invalid, &error);
 
     if (error) {
         xil_printf("Error receiving data on Channel %d: %d\n\r", channel,
@@ -1261,16 +1798,8 @@ u32 getFSLData(u32 *data, u32 channel) {
         }
 
         for (i = 0; i < data[CMD_LEN] - 1; i++) {
-            if (channel == BOIDCPU_CHANNEL_1)
-                getfslx(value, BOIDCPU_CHANNEL_1, FSL_NONBLOCKING);
-            else if (channel == BOIDCPU_CHANNEL_2)
-                getfslx(value, BOIDCPU_CHANNEL_2, FSL_NONBLOCKING);
-#ifdef MASTER_IS_RESIDENT
-            else if (channel == BOIDMASTER_CHANNEL)
-                getfslx(value, BOIDMASTER_CHANNEL, FSL_NONBLOCKING);
-#endif
-
-            fsl_iserror(error);             // Was there an error?
+            int wordInvalid;
+            value = getFSLWord(channel, &wordInvalid, &error);
             if (error) {
                 xil_printf("Error receiving data on Channel %d: %d\n\r",
                         channel, error);
@@ -1283,6 +1812,41 @@ u32 getFSLData(u32 *data, u32 channel) {
     return invalid;
 }
 
+/******************************************************************************/
+/*
+ * Reads a word from an FSL channel without blocking. The getfslx() macro 
+ * takes the channel as part of the instruction, so there is a case for each 
+ * of the 16 channels that a MicroBlaze can have. 
+ *
+ * @param   channel     The FSL channel to read from
+ * @param   invalid     Set to 1 if there was no data, 0 otherwise
+ * @param   error       Set to 1 if there was an error, 0 otherwise
+ *
+ * @return              The word read
+ *
+ ******************************************************************************/
+#define GET_FSL_CASE(id)                                \
+    case id:                                            \
+        getfslx(value, id, FSL_NONBLOCKING);            \
+        fsl_isinvalid(invalidFlag);                     \
+        fsl_iserror(errorFlag);                         \
+        break;
+
+u32 getFSLWord(u32 channel, int *invalid, int *error) {
+    int invalidFlag = 1, errorFlag = 0, value = 0;
+
+    switch (channel) {
+        GET_FSL_CASE(0)  GET_FSL_CASE(1)  GET_FSL_CASE(2)  GET_FSL_CASE(3)
+        GET_FSL_CASE(4)  GET_FSL_CASE(5)  GET_FSL_CASE(6)  GET_FSL_CASE(7)
+        GET_FSL_CASE(8)  GET_FSL_CASE(9)  GET_FSL_CASE(10) GET_FSL_CASE(11)
+        GET_FSL_CASE(12) GET_FSL_CASE(13) GET_FSL_CASE(14) GET_FSL_CASE(15)
+    }
+
+    *invalid = invalidFlag;
+    *error = errorFlag;
+    return value;
+}
+
 /******************************************************************************/
 /*
  * A wrapper for putting data onto the (internal) FSL bus. Can catch write
@@ -1294,20 +1858,23 @@ u32 getFSLData(u32 *data, u32 channel) {
  * @return  None
  *
  ******************************************************************************/
+#define PUT_FSL_CASE(id)                                \
+    case id:                                            \
+        putfslx(value, id, FSL_DEFAULT);                \
+        fsl_isinvalid(invalid);                         \
+        fsl_iserror(error);                             \
+        break;
+
 void putFSLData(u32 value, u32 channel) {
     int error = 0, invalid = 0;
 
-    if (channel == BOIDCPU_CHANNEL_1)
-        putfslx(value, BOIDCPU_CHANNEL_1, FSL_DEFAULT);
-    else if (channel == BOIDCPU_CHANNEL_2)
-        putfslx(value, BOIDCPU_CHANNEL_2, FSL_DEFAULT);
-#ifdef MASTER_IS_RESIDENT
-    else if (channel == BOIDMASTER_CHANNEL)
-        putfslx(value, BOIDMASTER_CHANNEL, FSL_DEFAULT);
-#endif
-
-    fsl_isinvalid(invalid);
-    fsl_iserror(error);
+    // As with getFSLWord(), each channel needs its own putfslx()
+    switch (channel) {
+        PUT_FSL_CASE(0)  PUT_FSL_CASE(1)  PUT_FSL_CASE(2)  PUT_FSL_CASE(3)
+        PUT_FSL_CASE(4)  PUT_FSL_CASE(5)  PUT_FSL_CASE(6)  PUT_FSL_CASE(7)
+        PUT_FSL_CASE(8)  PUT_FSL_CASE(9)  PUT_FSL_CASE(10) PUT_FSL_CASE(11)
+        PUT_FSL_CASE(12) PUT_FSL_CASE(13) PUT_FSL_CASE(14) PUT_FSL_CASE(15)
+    }
 
     if (invalid) {
         xil_printf("Warning - channel %d is full: %d\n\r", channel, value);
@@ -1318,42 +1885,6 @@ void putFSLData(u32 value, u32 channel) {
     }
 }
 
-/******************************************************************************/
-/*
- * Splits a 32-bit value into four 8-bit values for transmission over Ethernet.
- *
- * @param   outputValue         The 32-bit value to split into 4 8-bit values
- * @param   outputArrayPointer  A pointer to the array to store the results
- * @param   idx                 The index location in the array to store at
- *
- * @return  None
- *
- ******************************************************************************/
-void encodeEthernetMessage(u32 outputValue, u8* outputArrayPointer, int* idx) {
-    outputArrayPointer[*idx + 0] = (outputValue & 0xff000000UL) >> 24;
-    outputArrayPointer[*idx + 1] = (outputValue & 0x00ff0000UL) >> 16;
-    outputArrayPointer[*idx + 2] = (outputValue & 0x0000ff00UL) >>  8;
-    outputArrayPointer[*idx + 3] = (outputValue & 0x000000ffUL);
-
-    *idx += 4;
-}
-
-/******************************************************************************/
-/*
- * Take four 8 bit values from Ethernet and combine into one 32 bit value
- * 
- * @param   inputZero   The most significant 8-bit byte
- * @param   inputOne    The second most significant 8-bit byte
- * @param   inputTwo    The second least significant 8-bit byte
- * @param   inputThree  The least significant 8-bit byte
- *
- * @return              An unsigned 32-bit integer of the combined input bytes
- *
- ******************************************************************************/
-u32 decodeEthernetMessage(u8 inputZero, u8 inputOne, u8 inputTwo, u8 inputThree) {
-    return (u32)((inputZero << 24) | (inputOne << 16) | (inputTwo << 8) | (inputThree));
-}
-
 /******************************************************************************/
 /*
  * Parses a message and prints it out to the standard output.
@@ -1436,6 +1967,11 @@ void printMessage(bool send, u32 *data) {
     case CMD_BOID:
         print("boid in transit                   ");
         break;
+    case CMD_BOID_BATCH:
+        print("boids in transit                  ");
+        decodeAndPrintBoids(data);
+        drawnAlready = true;
+        break;
     case MODE_DRAW:
         print("send boids to BoidGPU             ");
         break;
@@ -1447,6 +1983,9 @@ void printMessage(bool send, u32 *data) {
     case CMD_ACK:
         print("ACK signal                        ");
         break;
+    case CMD_ACK_TREE:
+        print("ACK tree position                 ");
+        break;
     case CMD_PING_END:
         print("end of ping                       ");
         break;
@@ -1580,6 +2119,18 @@ int setupEthernet() {
         return XST_FAILURE;
     }
 
+#ifdef EVENT_DRIVEN_LOOP
+    // Connect the FSL data exists interrupts, passing the channel to the handler
+    u32 channel = 0;
+    for (channel = 0; channel < FSL_CHANNEL_COUNT; channel++) {
+        Status = XIntc_Connect(&intc, FSL_INTERRUPT_ID(channel),
+            (XInterruptHandler)FSLDataHandler, (void *)(uintptr_t)channel);
+        if (Status != XST_SUCCESS) {
+            return XST_FAILURE;
+        }
+    }
+#endif
+
     /*
      * Start the interrupt controller such that interrupts are enabled for
      * all devices that cause interrupts, specify real mode so that
@@ -1593,6 +2144,12 @@ int setupEthernet() {
     // Enable the interrupt for the EmacLite in the Interrupt controller.
     XIntc_Enable(&intc, INTC_EMACLITE_ID);
 
+#ifdef EVENT_DRIVEN_LOOP
+    for (channel = 0; channel < FSL_CHANNEL_COUNT; channel++) {
+        XIntc_Enable(&intc, FSL_INTERRUPT_ID(channel));
+    }
+#endif
+
     // Initialise the exception table.
     Xil_ExceptionInit();
 
@@ -1620,9 +2177,11 @@ int setupEthernet() {
 /*
  * The Ethernet receive interrupt handler. Called when a new message external 
  * arrives at the FPGA. The message is stored in an internal circular array and 
- * the pointer for new arrivals is incremented. Then the message is inspected 
- * to see whether it is a valid Ethernet type for the simulation. If it is not, 
- * the pointer is decremented back to its previous value. 
+ * inspected to see whether it is a valid Ethernet type for the simulation. If 
+ * it is, the pointer for new arrivals is incremented. One slot of the array is 
+ * always left empty so that a full array can be told apart from an empty one. 
+ * If the array is full, the message is dropped and counted rather than 
+ * overwriting a message that has not been processed. 
  * 
  * @param   callBackRef     The callback reference
  *
@@ -1635,19 +2194,27 @@ static void EmacLiteRecvHandler(void *CallBackRef) {
     // Convert the argument to something useful.
     XEmacInstancePtr = (XEmacLite *)CallBackRef;
 
+    // Drop the message if the array is full
+    if (!receiveRingReserve(&extInputRing, EXT_INPUT_SIZE)) {
+        XEmacLite_FlushReceive(XEmacInstancePtr);
+#ifdef DEBUG
+        xil_printf("++ Receive Interrupt Triggered: Dropped (%d so far) ++\n\r",
+            extInputRing.dropCount);
+#endif
+        return;
+    }
+
     // Handle the Receive callback.
-    u8 extInputArrivalPtrOld = extInputArrivalPtr;
-    extInputArrivalPtr = (extInputArrivalPtr + 1) % EXT_INPUT_SIZE;
-    XEmacLite_Recv(XEmacInstancePtr, (u8 *)rawExternalInput[extInputArrivalPtrOld]);
+    u8 *frame = rawExternalInput[extInputRing.arrivalPtr];
+    XEmacLite_Recv(XEmacInstancePtr, frame);
 
-    if ((rawExternalInput[extInputArrivalPtrOld][12] == 0x55) &&
-            (rawExternalInput[extInputArrivalPtrOld][13] == 0xAA)) {
+    if ((frame[12] == 0x55) && (frame[13] == 0xAA)) {
+        receiveRingCommit(&extInputRing, EXT_INPUT_SIZE);
 #ifdef DEBUG
         xil_printf("++ Receive Interrupt Triggered: Relevant (a%d, p%d) ++\n\r",
-            extInputArrivalPtr, extInputProcessPtr);
+            extInputRing.arrivalPtr, extInputRing.processPtr);
 #endif
     } else {
-        extInputArrivalPtr--;
         XEmacLite_FlushReceive(&ether);     // Clear any received messages
     }
 }
@@ -1673,3 +2240,23 @@ static void EmacLiteSendHandler(void *CallBackRef) {
     // Convert the argument to something useful.
     XEmacInstancePtr = (XEmacLite *)CallBackRef;
 }
+
+#ifdef EVENT_DRIVEN_LOOP
+/******************************************************************************/
+/*
+ * The FSL data interrupt handler. Called when data arrives on an FSL channel 
+ * that was empty. The interrupt is level sensitive, so it is disabled until 
+ * channelDrained() is called for the channel. 
+ * 
+ * @param   callBackRef     The FSL channel that has data
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+static void FSLDataHandler(void *CallBackRef) {
+    u32 channel = (u32)(uintptr_t)CallBackRef;
+
+    XIntc_Disable(&intc, FSL_INTERRUPT_ID(channel));
+    channelDataExists[channel] = true;
+}
+#endif
@@ -0,0 +1,72 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * boidCPUCore.cpp
+ *
+ * Builds the BoidCPU core (boidCPU.cpp) for the host runtime. The core is
+ * placed in the boidcpu namespace so that it can be linked alongside the
+ * BoidMaster core, which uses many of the same names. HOST_RUNTIME gives each
+ * host thread its own BoidCPU state.
+ *
+ * The BoidCPUs are built with the FPGA capacity of 40 boids unless 
+ * BOIDCPU_CAPACITY names another BoidCPUCapacity (see boidCPU.h), e.g. 
+ * -DBOIDCPU_CAPACITY=HostCapacity for BoidCPUs of up to 4096 boids.
+ *
+ * The headers that boidCPU.h and boidCPU.cpp include are included here first,
+ * outside of the namespace, so that their include guards stop them from being
+ * included again inside it.
+ *
+ ******************************************************************************/
+
+/******************************* Include Files ********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <iostream>
+#include <ap_int.h>
+#include <ap_fixed.h>
+#include <hls_stream.h>
+#include "hls_math.h"
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/**************************** Constant Definitions ****************************/
+
+#define HOST_RUNTIME            true    // Build the BoidCPU for the host
+
+/******************************** BoidCPU Core ********************************/
+
+namespace boidcpu {
+#include "../boidCPU.cpp"
+
+// The most boids that a BoidCPU can hold, checked by the host runtime
+extern const uint32_t maxBoids = MAX_BOIDS;
+
+#ifdef DOUBLE_BUFFERED_BOIDS
+/******************************************************************************/
+/*
+ * Updates every boid of a BoidCPU into its next state buffer. The boids can be 
+ * updated in any order, so if the runtime is built with OpenMP (-fopenmp) the 
+ * updates are split across threads. This is kept out of the core as the HLS 
+ * tools do not support it.
+ *
+ * @param   cpu     The BoidCPU state
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void updateNextBoidsOnHost(BoidCPUContext &cpu) {
+    int count = cpu.boidCount;
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < count; i++) {
+        updateNextBoid(cpu, i);
+    }
+}
+#endif
+}  // namespace boidcpu
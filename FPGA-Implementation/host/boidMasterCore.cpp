@@ -0,0 +1,35 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * boidMasterCore.cpp
+ *
+ * Builds the BoidMaster core (boidMaster.cpp) for the host runtime. The core
+ * is placed in the boidmaster namespace so that it can be linked alongside the
+ * BoidCPU core, which uses many of the same names.
+ *
+ * The headers that boidMaster.h and boidMaster.cpp include are included here
+ * first, outside of the namespace, so that their include guards stop them from
+ * being included again inside it.
+ *
+ ******************************************************************************/
+
+/******************************* Include Files ********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <chrono>
+#include <ap_int.h>
+#include <ap_fixed.h>
+#include <hls_stream.h>
+#include "hls_math.h"
+
+/**************************** Constant Definitions ****************************/
+
+#define HOST_RUNTIME            true    // Build the BoidMaster for the host
+
+/****************************** BoidMaster Core *******************************/
+
+namespace boidmaster {
+#include "../boidMaster.cpp"
+}  // namespace boidmaster
@@ -0,0 +1,168 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * ethernetBenchmark.cpp
+ *
+ * A host microbenchmark of the Gatekeeper's Ethernet encoding (see
+ * ethernetCodec.h). Full length commands are encoded into a frame and decoded
+ * again, a word at a time with encodeEthernetMessage() and
+ * decodeEthernetMessage() as the Gatekeeper used to, and a command at a time
+ * with encodeEthernetWords() and decodeEthernetWords(). The results of the
+ * two are checked against each other and the time taken per command is
+ * reported.
+ *
+ * The commands are written after a 14-byte Ethernet header, as they are by the
+ * Gatekeeper, so they are not word aligned.
+ *
+ * The result only holds for the processor that the benchmark is run on. The
+ * Gatekeeper's MicroBlaze has no byte swap instruction unless it is built with
+ * the reorder instructions, so ethernetCodec.h shifts the bytes there and the
+ * whole command functions are not expected to be much faster.
+ *
+ * Usage: ethernetBenchmark [commands]
+ *
+ ******************************************************************************/
+
+/******************************* Include Files ********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>                   // For timing the encoding
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+
+#include "../ethernetCodec.h"
+
+/**************************** Constant Definitions ****************************/
+
+#define CMD_HEADER_LEN          4   // The length of the command header
+#define MAX_CMD_BODY_LEN        30  // The max length of the command body
+#define MAX_CMD_LEN             (CMD_HEADER_LEN + MAX_CMD_BODY_LEN)
+
+#define FRAME_OFFSET            14  // The length of the Ethernet header
+#define DEFAULT_COMMANDS        1000000
+
+/*************************** Variable Definitions *****************************/
+
+u32 command[MAX_CMD_LEN];
+u32 decoded[MAX_CMD_LEN];
+u8 frame[FRAME_OFFSET + ((MAX_CMD_LEN) * 4)];
+
+// Summed over the decoded commands so that the work cannot be optimised away
+volatile u32 checksum = 0;
+
+/***************************** Function Definitions ***************************/
+
+/******************************************************************************/
+/*
+ * Encodes and decodes a command a word at a time, as the Gatekeeper did
+ * before encodeEthernetWords() and decodeEthernetWords() were added.
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void perWordCommand() {
+    int idx = FRAME_OFFSET;
+    for (int i = 0; i < MAX_CMD_LEN; i++) {
+        encodeEthernetMessage(command[i], frame, &idx);
+    }
+
+    for (int i = 0, j = FRAME_OFFSET; i < MAX_CMD_LEN; i++, j += 4) {
+        decoded[i] = decodeEthernetMessage(frame[j + 0], frame[j + 1],
+                frame[j + 2], frame[j + 3]);
+    }
+}
+
+/******************************************************************************/
+/*
+ * Encodes and decodes a command with one call each.
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void wholeCommand() {
+    int idx = FRAME_OFFSET;
+    encodeEthernetWords(command, MAX_CMD_LEN, frame, &idx);
+    decodeEthernetWords(&frame[FRAME_OFFSET], MAX_CMD_LEN, decoded);
+}
+
+/******************************************************************************/
+/*
+ * Times a number of encodes and decodes of a command, changing the command
+ * each time.
+ *
+ * @param   name        The name to report the time under
+ * @param   codec       The function that encodes and decodes the command
+ * @param   commands    The number of commands to encode and decode
+ *
+ * @return              The time taken per command in nanoseconds
+ *
+ ******************************************************************************/
+double timeCodec(const char *name, void (*codec)(), long commands) {
+    std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+
+    for (long i = 0; i < commands; i++) {
+        command[i % MAX_CMD_LEN] = (u32)i * 2654435761UL;
+        codec();
+        checksum += decoded[i % MAX_CMD_LEN];
+    }
+
+    double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    double nanoseconds = (seconds * 1e9) / commands;
+
+    printf("%-10s %8.1f ns per command (%d words)\n", name, nanoseconds,
+            MAX_CMD_LEN);
+    return nanoseconds;
+}
+
+/******************************************************************************/
+/*
+ * Checks that both codecs produce the same frame and decode it to the
+ * original command.
+ *
+ * @return              True if the codecs agree, false otherwise
+ *
+ ******************************************************************************/
+bool codecsAgree() {
+    u8 perWordFrame[sizeof(frame)];
+
+    for (int i = 0; i < MAX_CMD_LEN; i++) {
+        command[i] = 0x01020304UL * (i + 1) + 0xF0000000UL;
+    }
+
+    perWordCommand();
+    memcpy(perWordFrame, frame, sizeof(frame));
+    if (memcmp(decoded, command, sizeof(command)) != 0) {
+        return false;
+    }
+
+    memset(frame, 0, sizeof(frame));
+    memset(decoded, 0, sizeof(decoded));
+    wholeCommand();
+
+    return (memcmp(perWordFrame, frame, sizeof(frame)) == 0) &&
+            (memcmp(decoded, command, sizeof(command)) == 0);
+}
+
+int main(int argc, char *argv[]) {
+    long commands = (argc > 1) ? atol(argv[1]) : DEFAULT_COMMANDS;
+    if (commands < 1) {
+        commands = DEFAULT_COMMANDS;
+    }
+
+    if (!codecsAgree()) {
+        printf("The per-word and whole command encodings differ\n");
+        return 1;
+    }
+
+    double perWord = timeCodec("Per word", perWordCommand, commands);
+    double whole = timeCodec("Command", wholeCommand, commands);
+    printf("Speed up   %8.2fx\n", perWord / whole);
+
+    return 0;
+}
@@ -0,0 +1,208 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * eventSourceTest.cpp
+ *
+ * A host test of the Gatekeeper's event-driven input loop (see eventSource.h).
+ * The FSL channels are replaced by synthetic message queues. A channel
+ * signals data when a message is queued on it while its signal is enabled,
+ * and its signal is disabled until it is drained, as the level-sensitive FSL
+ * data interrupts are on the Gatekeeper. The test checks that a busy channel
+ * cannot hold up the others, that the channels take turns to go first, that
+ * only signalled channels are read and that nothing is read while waiting.
+ *
+ * Usage: eventSourceTest
+ *
+ ******************************************************************************/
+
+/******************************* Include Files ********************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint32_t u32;
+
+#include "../eventSource.h"
+#include "hostTest.h"
+
+/**************************** Constant Definitions ****************************/
+
+#define CHANNEL_COUNT           3   // A resident BoidMaster and two BoidCPUs
+#define CHANNEL_QUOTA           4   // As in gatekeeper.c
+#define QUEUE_SIZE              32  // The most messages queued on a channel
+
+/*************************** Variable Definitions *****************************/
+
+u32 queues[CHANNEL_COUNT][QUEUE_SIZE];
+int queued[CHANNEL_COUNT];          // Messages waiting on each channel
+int readPtr[CHANNEL_COUNT];         // The next message to read on each channel
+bool signalled[CHANNEL_COUNT];      // Set as the data interrupt would be
+
+int reads[CHANNEL_COUNT];           // Reads of each channel, including empty
+int unsignalledReads = 0;           // Reads of channels that had not signalled
+int drains[CHANNEL_COUNT];          // Times each channel was found empty
+int processed[CHANNEL_COUNT];       // Messages processed from each channel
+int processOrder[QUEUE_SIZE * CHANNEL_COUNT];   // Channels, as processed
+int processCount = 0;
+
+int otherEventPolls = 0;            // Polls until the other event arrives
+
+/***************************** Function Definitions ***************************/
+
+/******************************************************************************/
+/*
+ * Queues a number of messages on a channel. Each message holds its channel.
+ *
+ * @param   channel     The channel to queue the messages on
+ * @param   count       The number of messages to queue
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void queueMessages(u32 channel, int count) {
+    for (int i = 0; i < count; i++) {
+        queues[channel][(readPtr[channel] + queued[channel]) % QUEUE_SIZE] =
+                channel;
+        queued[channel]++;
+    }
+
+    signalled[channel] = true;
+}
+
+/******************************************************************************/
+/*
+ * Clears the queues and the counts kept by the synthetic event source.
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void reset() {
+    memset(queued, 0, sizeof(queued));
+    memset(readPtr, 0, sizeof(readPtr));
+    memset(signalled, 0, sizeof(signalled));
+    memset(reads, 0, sizeof(reads));
+    memset(drains, 0, sizeof(drains));
+    memset(processed, 0, sizeof(processed));
+    unsignalledReads = 0;
+    processCount = 0;
+    otherEventPolls = 0;
+}
+
+// The synthetic event source. Its functions are described in eventSource.h.
+// Another event arrives once it has been polled for otherEventPolls times.
+int otherEventWaiting(void) {
+    if (otherEventPolls > 0) {
+        otherEventPolls--;
+        return otherEventPolls == 0;
+    }
+
+    return 0;
+}
+
+int channelSignalled(u32 channel) {
+    return signalled[channel];
+}
+
+int readChannel(u32 channel, u32 *data) {
+    reads[channel]++;
+    if (!signalled[channel]) {
+        unsignalledReads++;
+    }
+
+    if (queued[channel] == 0) {
+        return 0;
+    }
+
+    data[0] = queues[channel][readPtr[channel]];
+    readPtr[channel] = (readPtr[channel] + 1) % QUEUE_SIZE;
+    queued[channel]--;
+    return 1;
+}
+
+void channelDrained(u32 channel) {
+    drains[channel]++;
+    signalled[channel] = false;
+}
+
+void processMessage(u32 *data) {
+    processed[data[0]]++;
+    processOrder[processCount++] = data[0];
+}
+
+const EventSource queueEvents = {otherEventWaiting, channelSignalled,
+        readChannel, channelDrained, processMessage};
+
+int main() {
+    u32 data[1];
+    u32 firstChannel = 0;
+
+    // A busy channel is limited to its quota while the others drain
+    reset();
+    queueMessages(0, 2);
+    queueMessages(1, 20);
+    queueMessages(2, 3);
+    firstChannel = serviceChannels(&queueEvents, CHANNEL_COUNT, CHANNEL_QUOTA,
+            firstChannel, data);
+    check("Busy channel gets its quota of 4 per pass", processed[1] == 4);
+    check("Quiet channels drain in the first pass",
+            (processed[0] == 2) && (processed[2] == 3) &&
+            (drains[0] == 1) && (drains[2] == 1));
+    check("Busy channel is not drained while it has data",
+            (drains[1] == 0) && signalled[1]);
+
+    bool quotaKept = true;
+    int passes = 1;
+    while (signalled[1]) {
+        int before = processed[1];
+        firstChannel = serviceChannels(&queueEvents, CHANNEL_COUNT,
+                CHANNEL_QUOTA, firstChannel, data);
+        if ((processed[1] - before) > CHANNEL_QUOTA) {
+            quotaKept = false;
+        }
+        passes++;
+    }
+    check("Busy channel never exceeds its quota", quotaKept);
+    check("Busy channel of 20 drains on the sixth pass",
+            (processed[1] == 20) && (passes == 6) && (drains[1] == 1));
+    check("Only signalled channels are read", unsignalledReads == 0);
+    check("Drained channels are not read again",
+            (reads[0] == 3) && (reads[2] == 4));
+
+    // The channels take turns to go first
+    reset();
+    firstChannel = 1;
+    queueMessages(0, 1);
+    queueMessages(1, 1);
+    queueMessages(2, 1);
+    firstChannel = serviceChannels(&queueEvents, CHANNEL_COUNT, CHANNEL_QUOTA,
+            firstChannel, data);
+    check("Servicing starts at the given channel",
+            (processOrder[0] == 1) && (processOrder[1] == 2) &&
+            (processOrder[2] == 0));
+    check("The next pass starts at the following channel", firstChannel == 2);
+    firstChannel = serviceChannels(&queueEvents, CHANNEL_COUNT, CHANNEL_QUOTA,
+            firstChannel, data);
+    check("The first channel wraps", firstChannel == 0);
+
+    // Waiting reads no channels and returns on either kind of event
+    reset();
+    queueMessages(2, 1);
+    waitForEvents(&queueEvents, CHANNEL_COUNT);
+    check("Waiting returns when a channel signals",
+            (reads[0] + reads[1] + reads[2]) == 0);
+
+    reset();
+    otherEventPolls = 1000;
+    waitForEvents(&queueEvents, CHANNEL_COUNT);
+    check("Waiting returns on another event", otherEventPolls == 0);
+    check("No channel is read while waiting",
+            (reads[0] + reads[1] + reads[2]) == 0);
+
+    firstChannel = serviceChannels(&queueEvents, CHANNEL_COUNT, CHANNEL_QUOTA,
+            firstChannel, data);
+    check("Idle channels are not read",
+            (reads[0] + reads[1] + reads[2]) == 0);
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * hls_stream.h
+ *
+ * A host replacement for the Vivado HLS hls::stream class, used by the host
+ * runtime to connect BoidCPU and BoidMaster cores that each run on their own
+ * thread. Each stream is a lock-free single-producer, single-consumer (SPSC)
+ * ring buffer: one thread writes to it and one other thread reads from it.
+ *
+ * As on the FPGA, reading from an empty stream blocks until data is available
+ * and writing to a full stream blocks until there is space. The host/
+ * directory must be placed before the Vivado HLS include directory on the
+ * include path so that this file is used in place of the HLS version.
+ *
+ ******************************************************************************/
+
+#ifndef __HOST_HLS_STREAM_H_
+#define __HOST_HLS_STREAM_H_
+
+/******************************* Include Files ********************************/
+
+#include <stddef.h>
+#include <atomic>
+#include <thread>                   // For yield()
+
+/**************************** Constant Definitions ****************************/
+
+#define HOST_STREAM_DEPTH       16384   // Stream capacity, must be a power of 2
+#define HOST_CACHE_LINE_SIZE    64      // Keeps the head and tail apart
+
+/****************************** Class Definitions *****************************/
+
+namespace hls {
+
+template<typename T>
+class stream {
+ public:
+    stream() : head(0), tail(0) {
+        buffer = new T[HOST_STREAM_DEPTH];
+    }
+
+    explicit stream(const char *name) : head(0), tail(0) {
+        buffer = new T[HOST_STREAM_DEPTH];
+    }
+
+    ~stream() {
+        delete[] buffer;
+    }
+
+    /**************************************************************************/
+    /*
+     * Reads the next value from the stream, blocking until one is available.
+     *
+     * @return  The value read
+     *
+     **************************************************************************/
+    T read() {
+        T value;
+        while (!read_nb(value)) {
+            std::this_thread::yield();
+        }
+        return value;
+    }
+
+    void read(T &value) {
+        value = read();
+    }
+
+    /**************************************************************************/
+    /*
+     * Reads the next value from the stream if there is one.
+     *
+     * @param   value   Where to store the value read
+     *
+     * @return  True if a value was read, false if the stream was empty
+     *
+     **************************************************************************/
+    bool read_nb(T &value) {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        value = buffer[currentHead & (HOST_STREAM_DEPTH - 1)];
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**************************************************************************/
+    /*
+     * Writes a value to the stream, blocking until there is space for it.
+     *
+     * @param   value   The value to write
+     *
+     * @return  None
+     *
+     **************************************************************************/
+    void write(const T &value) {
+        while (!write_nb(value)) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**************************************************************************/
+    /*
+     * Writes a value to the stream if there is space for it.
+     *
+     * @param   value   The value to write
+     *
+     * @return  True if the value was written, false if the stream was full
+     *
+     **************************************************************************/
+    bool write_nb(const T &value) {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        if ((currentTail - head.load(std::memory_order_acquire)) ==
+                HOST_STREAM_DEPTH) {
+            return false;
+        }
+
+        buffer[currentTail & (HOST_STREAM_DEPTH - 1)] = value;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() {
+        return head.load(std::memory_order_acquire) ==
+                tail.load(std::memory_order_acquire);
+    }
+
+    bool full() {
+        return (tail.load(std::memory_order_acquire) -
+                head.load(std::memory_order_acquire)) == HOST_STREAM_DEPTH;
+    }
+
+    void operator>>(T &value) {
+        read(value);
+    }
+
+    void operator<<(const T &value) {
+        write(value);
+    }
+
+ private:
+    // Streams connect two cores and so cannot be copied
+    stream(const stream &);
+    stream &operator=(const stream &);
+
+    T *buffer;
+
+    // The index of the next value to read, only changed by the consumer
+    alignas(HOST_CACHE_LINE_SIZE) std::atomic<size_t> head;
+
+    // The index of the next free slot, only changed by the producer
+    alignas(HOST_CACHE_LINE_SIZE) std::atomic<size_t> tail;
+};
+
+}  // namespace hls
+
+#endif
@@ -0,0 +1,675 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * hostRuntime.cpp
+ *
+ * A host runtime that runs a whole simulation system in one process. One
+ * BoidMaster core and a number of BoidCPU cores are each run on their own
+ * thread, connected to a router by lock-free single-producer, single-consumer
+ * streams (see hls_stream.h). The router stands in for one or more
+ * Gatekeepers (gatekeeper.c) that share the BoidCPUs between them: it responds
+ * to the BoidMaster's ping, hands out the setup information, routes messages
+ * between the cores, collects the BoidCPU ACKs into a single ACK for each
+ * Gatekeeper and acts as the BoidGPU. This allows the multi-BoidCPU protocol
+ * to run at full CPU speed.
+ *
+ * If the BoidMaster defines ACK_TREE, the simulated Gatekeepers combine their
+ * ACKs in the tree that the BoidMaster sets up, as the Gatekeepers would. The
+ * number of ACKs that the BoidMaster receives is reported at the end.
+ *
+ * Usage: boids [BoidCPU count] [boid count] [time steps] [Gatekeeper count]
+ *
+ * The BoidCPU count is limited to the BoidMaster's MAX_OUTPUT_CMDS as the
+ * BoidMaster issues all the setup messages at once. At least 2 BoidCPUs are
+ * needed as a lone BoidCPU only finds its neighbours if REDUCED_LUT_USAGE is
+ * not defined. No BoidCPU can be given more boids than its capacity (40 boids
+ * by default), and the BoidMaster gives any remaining boids to the last
+ * BoidCPU. A BoidCPU that fills up as the boids flock asserts rather than
+ * drop a boid, so larger simulations need a larger capacity. Each Gatekeeper
+ * serves at least one BoidCPU, with any remainder going to the first
+ * Gatekeepers. The output of the cores is discarded unless HOST_VERBOSE is
+ * defined. The time taken to simulate is reported as the number of time steps
+ * and boid updates per second, so that BoidCPU capacities (see boidCPUCore.cpp)
+ * can be compared. The runtime exits with 1 if the last time step did not draw
+ * every boid.
+ *
+ ******************************************************************************/
+
+/******************************* Include Files ********************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <iostream>
+#include <streambuf>
+#include <thread>
+#include <new>                      // For placement new
+#include <chrono>                   // For timing the simulation
+#include <ap_int.h>
+#include <hls_stream.h>
+#include "../boidCommands.h"        // The command definitions of the cores
+
+/**************************** Constant Definitions ****************************/
+
+// #define HOST_VERBOSE             true    // Define to keep the core output
+// #define ASYNC_TIME_STEPS         true    // Define if the cores define it
+
+#define MAX_BOIDCPU_NEIGHBOURS  8   // The maximum neighbours a BoidCPUs has
+
+#define ROUTER_ID               999 // The ID of the first simulated Gatekeeper
+#define MASTER_CHANNEL          0   // The channel of the BoidMaster
+
+#define MIN_HOST_BOIDCPUS       2
+#define MAX_HOST_BOIDCPUS       10  // The BoidMaster's MAX_OUTPUT_CMDS
+#define DEFAULT_BOIDCPU_COUNT   8
+#define DEFAULT_BOIDS_PER_CPU   5
+#define DEFAULT_TIME_STEPS      100
+#define DEFAULT_GATEKEEPER_COUNT    1
+
+#define STEP_WINDOW             16  // Time steps that draws can be spread over
+
+#define USAGE   "Usage: boids [BoidCPU count] [boid count] [time steps] " \
+        "[Gatekeeper count]"
+
+/****************************** Type Definitions ******************************/
+
+typedef ap_uint<32> uint32;
+
+// A simulated Gatekeeper, its BoidCPU channels and its place in the ACK tree
+struct Gatekeeper {
+    uint32 id;
+    uint32_t firstChannel;              // The channel of its first BoidCPU
+    uint32_t boidCPUCount;
+    uint32_t setupCounter;              // Its BoidCPUs that have been setup
+    uint32 parentID;                    // Where its collective ACK is sent
+    uint32_t childCount;                // Its child Gatekeepers
+    uint32_t ackCount;                  // The BoidCPU and child ACKs received
+    uint32_t ackRebuildFlag;            // OR of the neighbour list ACK flags
+    uint32_t ackBoidCount;              // The boids in its ACK subtree
+    uint32_t ackMaxLoad;                // The largest BoidCPU boid count
+    uint32_t ackBoidCPUCount;           // The BoidCPUs in its ACK subtree
+};
+
+// A core and the streams that connect it to the router
+struct Channel {
+    hls::stream<uint32> toCore;
+    hls::stream<uint32> fromCore;
+    uint32 id;
+    uint32 neighbours[MAX_BOIDCPU_NEIGHBOURS];
+    Gatekeeper *gatekeeper;             // The Gatekeeper serving the BoidCPU
+};
+
+// Discards the output of the cores
+class NullBuffer : public std::streambuf {
+ protected:
+    int overflow(int c) { return c; }
+};
+
+/**************************** Function Prototypes *****************************/
+
+namespace boidcpu {
+void toplevel(hls::stream<uint32> &input, hls::stream<uint32> &output);
+extern const uint32_t maxBoids;
+}
+
+namespace boidmaster {
+void boidMaster(hls::stream<uint32> &input, hls::stream<uint32> &output);
+}
+
+void route();
+bool readMessage(Channel *channel, uint32 *data);
+void processMasterMessage(uint32 *data);
+void processBoidCPUMessage(Channel *channel, uint32 *data);
+void collectAck(Gatekeeper *gatekeeper, uint32 *data);
+Gatekeeper *findGatekeeper(uint32 id);
+void deliverMessage(uint32 *data);
+void sendToChannel(uint8_t channel, uint32 *data);
+void sendToChannel(uint8_t channel, uint32 len, uint32 to, uint32 from,
+        uint32 type, uint32 *body);
+bool isNeighbourOf(Channel *channel, uint32 id);
+
+/**************************** Variable Definitions ****************************/
+
+Channel *channels;                      // The master channel then BoidCPUs
+uint32_t boidCPUCount = DEFAULT_BOIDCPU_COUNT;
+uint32_t boidCount = DEFAULT_BOIDCPU_COUNT * DEFAULT_BOIDS_PER_CPU;
+uint32_t timeSteps = DEFAULT_TIME_STEPS;
+
+Gatekeeper *gatekeepers;                // The simulated Gatekeepers
+uint32_t gatekeeperCount = DEFAULT_GATEKEEPER_COUNT;
+uint32_t masterAckCount = 0;            // The Gatekeeper ACKs to the BoidMaster
+// The BoidCPUs that have drawn all their boids and the boids drawn, for each 
+// time step in the window that starts at the current time step
+uint32_t drawnBoidCPUCount[STEP_WINDOW];
+uint32_t drawnBoidsCount[STEP_WINDOW];
+uint32_t timeStep = 0;
+uint32_t lastDrawnBoidsCount = 0;       // The boids drawn on the last step
+bool routerRunning = true;
+
+/******************************************************************************/
+/*
+ * Creates the cores and their streams, starts a thread for each core, then
+ * routes messages between them until the requested number of time steps has
+ * been simulated.
+ *
+ * @param   argc    The number of command line arguments
+ * @param   argv    The BoidCPU, boid, time step and Gatekeeper counts
+ *
+ * @return  0 on success, 1 if the arguments are invalid or the channels cannot 
+ *          be allocated
+ *
+ ******************************************************************************/
+int main(int argc, char *argv[]) {
+    if (argc > 1) boidCPUCount = atoi(argv[1]);
+    boidCount = boidCPUCount * DEFAULT_BOIDS_PER_CPU;
+    if (argc > 2) boidCount = atoi(argv[2]);
+    if (argc > 3) timeSteps = atoi(argv[3]);
+    if (argc > 4) gatekeeperCount = atoi(argv[4]);
+
+    if ((boidCPUCount < MIN_HOST_BOIDCPUS) ||
+            (boidCPUCount > MAX_HOST_BOIDCPUS)) {
+        fprintf(stderr, "The BoidCPU count must be between %d and %d\n",
+                MIN_HOST_BOIDCPUS, MAX_HOST_BOIDCPUS);
+        fprintf(stderr, "%s\n", USAGE);
+        return 1;
+    }
+
+    if ((gatekeeperCount < 1) || (gatekeeperCount > boidCPUCount)) {
+        fprintf(stderr, "The Gatekeeper count must be between 1 and %u\n",
+                boidCPUCount);
+        fprintf(stderr, "%s\n", USAGE);
+        return 1;
+    }
+
+    // The BoidMaster gives any remaining boids to the last BoidCPU
+    uint32_t mostBoidsPerCPU = (boidCount / boidCPUCount) +
+            (boidCount % boidCPUCount);
+    if (boidCount < 1) {
+        fprintf(stderr, "At least one boid must be simulated\n");
+        fprintf(stderr, "%s\n", USAGE);
+        return 1;
+    } else if (mostBoidsPerCPU > boidcpu::maxBoids) {
+        fprintf(stderr, "A BoidCPU would be given %u boids, but holds at most "
+                "%u\n", mostBoidsPerCPU, boidcpu::maxBoids);
+        fprintf(stderr, "%s\n", USAGE);
+        return 1;
+    }
+
+    if (timeSteps < 1) {
+        fprintf(stderr, "At least one time step must be simulated\n");
+        fprintf(stderr, "%s\n", USAGE);
+        return 1;
+    }
+
+#ifndef HOST_VERBOSE
+    NullBuffer nullBuffer;
+    std::streambuf *coutBuffer = std::cout.rdbuf(&nullBuffer);
+#endif
+
+    // The streams of a channel are cache line aligned, which new[] does not 
+    // guarantee before C++17
+    void *channelMemory = NULL;
+    if (posix_memalign(&channelMemory, alignof(Channel),
+            sizeof(Channel) * (boidCPUCount + 1)) != 0) {
+        fprintf(stderr, "Unable to allocate the channels\n");
+        return 1;
+    }
+
+    channels = (Channel *)channelMemory;
+    for (uint32_t i = 0; i < boidCPUCount + 1; i++) {
+        new (&channels[i]) Channel();
+        channels[i].id = (i == MASTER_CHANNEL) ? CONTROLLER_ID : CMD_BROADCAST;
+        for (int j = 0; j < MAX_BOIDCPU_NEIGHBOURS; j++) {
+            channels[i].neighbours[j] = CMD_BROADCAST;
+        }
+        channels[i].gatekeeper = NULL;
+    }
+
+    // Share the BoidCPU channels between the Gatekeepers. Until the BoidMaster
+    // sets up an ACK tree, every Gatekeeper ACKs the BoidMaster directly.
+    gatekeepers = new Gatekeeper[gatekeeperCount];
+    uint32_t channel = 1;
+    for (uint32_t i = 0; i < gatekeeperCount; i++) {
+        Gatekeeper *gatekeeper = &gatekeepers[i];
+        gatekeeper->id = ROUTER_ID + i;
+        gatekeeper->firstChannel = channel;
+        gatekeeper->boidCPUCount = (boidCPUCount / gatekeeperCount) +
+                ((i < (boidCPUCount % gatekeeperCount)) ? 1 : 0);
+        gatekeeper->setupCounter = 0;
+        gatekeeper->parentID = CONTROLLER_ID;
+        gatekeeper->childCount = 0;
+        gatekeeper->ackCount = 0;
+        gatekeeper->ackRebuildFlag = 0;
+        gatekeeper->ackBoidCount = 0;
+        gatekeeper->ackMaxLoad = 0;
+        gatekeeper->ackBoidCPUCount = 0;
+
+        for (uint32_t j = 0; j < gatekeeper->boidCPUCount; j++) {
+            channels[channel].gatekeeper = gatekeeper;
+            channel++;
+        }
+    }
+
+    std::thread *threads = new std::thread[boidCPUCount + 1];
+    threads[MASTER_CHANNEL] = std::thread(boidmaster::boidMaster,
+            std::ref(channels[MASTER_CHANNEL].toCore),
+            std::ref(channels[MASTER_CHANNEL].fromCore));
+    for (uint32_t i = 1; i < boidCPUCount + 1; i++) {
+        threads[i] = std::thread(boidcpu::toplevel,
+                std::ref(channels[i].toCore), std::ref(channels[i].fromCore));
+    }
+
+    std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+
+    route();
+
+    double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+    for (uint32_t i = 0; i < boidCPUCount + 1; i++) {
+        threads[i].join();
+    }
+
+#ifndef HOST_VERBOSE
+    std::cout.rdbuf(coutBuffer);
+#endif
+
+    printf("Simulated %u time steps of %u boids on %u BoidCPUs\n",
+            timeSteps, boidCount, boidCPUCount);
+    printf("Took %.3f s: %.1f time steps/s, %.0f boid updates/s\n", seconds,
+            timeSteps / seconds, ((double)timeSteps * boidCount) / seconds);
+    printf("The BoidMaster received %u ACKs from %u Gatekeepers\n",
+            masterAckCount, gatekeeperCount);
+
+    int result = 0;
+    if (lastDrawnBoidsCount != boidCount) {
+        fprintf(stderr, "The last time step drew %u of %u boids\n",
+                lastDrawnBoidsCount, boidCount);
+        result = 1;
+    }
+
+    delete[] threads;
+    delete[] gatekeepers;
+    for (uint32_t i = 0; i < boidCPUCount + 1; i++) {
+        channels[i].~Channel();
+    }
+    free(channels);
+    return result;
+}
+
+/******************************************************************************/
+/*
+ * The main loop of the router. Starts the simulation by signalling the start
+ * of the ping to the BoidMaster and then polls the streams from each core in
+ * turn, processing any messages found. As a single thread does all of the
+ * routing, messages from a core are delivered in the order they were sent.
+ *
+ * @param   None
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void route() {
+    uint32 data[MAX_CMD_LEN];
+
+    sendToChannel(MASTER_CHANNEL, 0, CONTROLLER_ID, ROUTER_ID, CMD_PING_START,
+            data);
+
+    while (routerRunning) {
+        bool idle = true;
+
+        if (readMessage(&channels[MASTER_CHANNEL], data)) {
+            processMasterMessage(data);
+            idle = false;
+        }
+
+        for (uint32_t i = 1; (i < boidCPUCount + 1) && routerRunning; i++) {
+            if (readMessage(&channels[i], data)) {
+                processBoidCPUMessage(&channels[i], data);
+                idle = false;
+            }
+        }
+
+        if (idle) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ * Reads a message from a core if one has been sent. Once the first word of a
+ * message is available the rest of the message is read, blocking if needed.
+ *
+ * @param   channel The channel of the core to read from
+ * @param   data    Where to store the message
+ *
+ * @return  True if a message was read, false otherwise
+ *
+ ******************************************************************************/
+bool readMessage(Channel *channel, uint32 *data) {
+    if (!channel->fromCore.read_nb(data[CMD_LEN])) {
+        return false;
+    }
+
+    for (uint32_t i = 1; i < data[CMD_LEN]; i++) {
+        data[i] = channel->fromCore.read();
+    }
+    return true;
+}
+
+/******************************************************************************/
+/*
+ * Processes a message from the BoidMaster. A ping is answered by each
+ * Gatekeeper with its number of BoidCPUs, followed by the end of the ping and
+ * the user information, as a Gatekeeper with the BoidMaster resident would.
+ * Setup messages addressed to a Gatekeeper are handed to its BoidCPUs in
+ * channel order and the ID and neighbours of each BoidCPU are recorded for
+ * routing. The position of a Gatekeeper in the ACK tree is recorded. Other
+ * messages are delivered to their recipients.
+ *
+ * @param   data    The message
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void processMasterMessage(uint32 *data) {
+    uint32 body[1];
+    Gatekeeper *gatekeeper = findGatekeeper(data[CMD_TO]);
+
+    if (data[CMD_TYPE] == CMD_PING) {
+        for (uint32_t i = 0; i < gatekeeperCount; i++) {
+            body[0] = gatekeepers[i].boidCPUCount;
+            sendToChannel(MASTER_CHANNEL, 1, CONTROLLER_ID, gatekeepers[i].id,
+                    CMD_PING_REPLY, body);
+        }
+        sendToChannel(MASTER_CHANNEL, 0, CONTROLLER_ID, ROUTER_ID,
+                CMD_PING_END, body);
+
+        body[0] = boidCount;
+        sendToChannel(MASTER_CHANNEL, 1, CONTROLLER_ID, ROUTER_ID,
+                CMD_USER_INFO, body);
+    } else if ((data[CMD_TYPE] == CMD_SIM_SETUP) && (gatekeeper != NULL) &&
+            (gatekeeper->setupCounter < gatekeeper->boidCPUCount)) {
+        uint32_t channelIndex = gatekeeper->firstChannel +
+                gatekeeper->setupCounter;
+        Channel *channel = &channels[channelIndex];
+        channel->id = data[CMD_HEADER_LEN + CMD_SETUP_NEWID_IDX];
+        for (int i = 0; i < MAX_BOIDCPU_NEIGHBOURS; i++) {
+            channel->neighbours[i] =
+                    data[CMD_HEADER_LEN + CMD_SETUP_BNBRS_IDX + i];
+        }
+
+        // The BoidCPU does not yet know its ID, so broadcast to it
+        data[CMD_TO] = CMD_BROADCAST;
+        sendToChannel(channelIndex, data);
+        gatekeeper->setupCounter++;
+    } else if ((data[CMD_TYPE] == CMD_ACK_TREE) && (gatekeeper != NULL)) {
+        gatekeeper->parentID = data[CMD_HEADER_LEN + CMD_TREE_PARENT_IDX];
+        gatekeeper->childCount =
+                data[CMD_HEADER_LEN + CMD_TREE_CHILD_IDX].to_uint();
+    } else {
+        deliverMessage(data);
+    }
+}
+
+/******************************************************************************/
+/*
+ * Processes a message from a BoidCPU. ACKs are collected by the Gatekeeper
+ * serving the BoidCPU (see collectAck()). Draw
+ * information is consumed on behalf of the BoidGPU, which ACKs when every
+ * BoidCPU has sent its last draw message. When the requested number of time
+ * steps has been simulated every core is killed instead. Other messages are
+ * delivered to their recipients.
+ *
+ * If ASYNC_TIME_STEPS is defined, the BoidCPUs can be drawing different time
+ * steps at once, so the draw messages are counted against the time step they
+ * are tagged with. The time steps are still ACKed in order.
+ *
+ * @param   channel The channel of the BoidCPU
+ * @param   data    The message
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void processBoidCPUMessage(Channel *channel, uint32 *data) {
+    uint32 body[1];
+
+    if (data[CMD_TYPE] == CMD_ACK) {
+        collectAck(channel->gatekeeper, data);
+    } else if (data[CMD_TO] == BOIDGPU_ID) {
+        if (data[CMD_TYPE] == CMD_DRAW_INFO) {
+#ifdef ASYNC_TIME_STEPS
+            // The time step is the last body word
+            uint32_t slot = data[data[CMD_LEN].to_uint() - 1].to_uint() %
+                    STEP_WINDOW;
+#else
+            uint32_t slot = timeStep % STEP_WINDOW;
+#endif
+
+            drawnBoidsCount[slot] += (data[CMD_LEN].to_uint() -
+                    CMD_HEADER_LEN - 1) / BOID_DATA_LENGTH;
+
+            // The first body word is the number of draw messages to follow
+            if (data[CMD_HEADER_LEN + 0] == 0) {
+                drawnBoidCPUCount[slot]++;
+            }
+        }
+
+        while (routerRunning &&
+                (drawnBoidCPUCount[timeStep % STEP_WINDOW] == boidCPUCount)) {
+            uint32_t slot = timeStep % STEP_WINDOW;
+
+            if (drawnBoidsCount[slot] != boidCount) {
+                fprintf(stderr, "Time step %u: %u of %u boids drawn\n",
+                        timeStep, drawnBoidsCount[slot], boidCount);
+            }
+
+            lastDrawnBoidsCount = drawnBoidsCount[slot];
+            drawnBoidCPUCount[slot] = 0;
+            drawnBoidsCount[slot] = 0;
+            timeStep++;
+
+            if (timeStep == timeSteps) {
+                for (uint32_t i = 0; i < boidCPUCount + 1; i++) {
+                    sendToChannel(i, 0, channels[i].id, ROUTER_ID, CMD_KILL,
+                            body);
+                }
+                routerRunning = false;
+            } else {
+                sendToChannel(MASTER_CHANNEL, 0, CONTROLLER_ID, BOIDGPU_ID,
+                        CMD_ACK, body);
+            }
+        }
+    } else {
+        deliverMessage(data);
+    }
+}
+
+/******************************************************************************/
+/*
+ * Collects an ACK for a Gatekeeper, from one of its BoidCPUs or from one of
+ * its child Gatekeepers in the ACK tree. When the Gatekeeper has an ACK from
+ * each, it sends a collective ACK to its parent: the BoidMaster or, if an ACK
+ * tree has been set up, another Gatekeeper. The collective ACK carries the
+ * type of the ACKs, the OR of their neighbour list rebuild flags and the boid
+ * count, largest BoidCPU boid count and BoidCPU count of the subtree. The
+ * BoidCPUs only report their boid count if they define ACK_TREE.
+ *
+ * @param   gatekeeper  The Gatekeeper collecting the ACK
+ * @param   data        The ACK
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void collectAck(Gatekeeper *gatekeeper, uint32 *data) {
+    uint32_t length = data[CMD_LEN].to_uint();
+    uint32_t load = 0;
+
+    gatekeeper->ackCount++;
+
+    if (length > CMD_HEADER_LEN + CMD_ACK_RBLD_IDX) {
+        gatekeeper->ackRebuildFlag |=
+                data[CMD_HEADER_LEN + CMD_ACK_RBLD_IDX].to_uint();
+    }
+
+    if (length > CMD_HEADER_LEN + CMD_ACK_CPUCNT_IDX) {
+        // The collective ACK of a child Gatekeeper
+        gatekeeper->ackBoidCount +=
+                data[CMD_HEADER_LEN + CMD_ACK_BDCNT_IDX].to_uint();
+        gatekeeper->ackBoidCPUCount +=
+                data[CMD_HEADER_LEN + CMD_ACK_CPUCNT_IDX].to_uint();
+        load = data[CMD_HEADER_LEN + CMD_ACK_LOAD_IDX].to_uint();
+    } else if (length > CMD_HEADER_LEN + CMD_ACK_BDCNT_IDX) {
+        // The ACK of a BoidCPU
+        gatekeeper->ackBoidCount +=
+                data[CMD_HEADER_LEN + CMD_ACK_BDCNT_IDX].to_uint();
+        gatekeeper->ackBoidCPUCount++;
+        load = data[CMD_HEADER_LEN + CMD_ACK_BDCNT_IDX].to_uint();
+    }
+
+    if (load > gatekeeper->ackMaxLoad) {
+        gatekeeper->ackMaxLoad = load;
+    }
+
+    if (gatekeeper->ackCount ==
+            (gatekeeper->boidCPUCount + gatekeeper->childCount)) {
+        uint32 ack[MAX_CMD_LEN];
+        ack[CMD_LEN]  = CMD_HEADER_LEN + CMD_ACK_CPUCNT_IDX + 1;
+        ack[CMD_TO]   = gatekeeper->parentID;
+        ack[CMD_FROM] = gatekeeper->id;
+        ack[CMD_TYPE] = CMD_ACK;
+        ack[CMD_HEADER_LEN + 0] = data[CMD_HEADER_LEN + 0];
+        ack[CMD_HEADER_LEN + CMD_ACK_RBLD_IDX] = gatekeeper->ackRebuildFlag;
+        ack[CMD_HEADER_LEN + CMD_ACK_BDCNT_IDX] = gatekeeper->ackBoidCount;
+        ack[CMD_HEADER_LEN + CMD_ACK_LOAD_IDX] = gatekeeper->ackMaxLoad;
+        ack[CMD_HEADER_LEN + CMD_ACK_CPUCNT_IDX] = gatekeeper->ackBoidCPUCount;
+
+        gatekeeper->ackCount = 0;
+        gatekeeper->ackRebuildFlag = 0;
+        gatekeeper->ackBoidCount = 0;
+        gatekeeper->ackMaxLoad = 0;
+        gatekeeper->ackBoidCPUCount = 0;
+
+        if (gatekeeper->parentID == CONTROLLER_ID) {
+            sendToChannel(MASTER_CHANNEL, ack);
+            masterAckCount++;
+        } else {
+            collectAck(findGatekeeper(gatekeeper->parentID), ack);
+        }
+    }
+}
+
+/******************************************************************************/
+/*
+ * Finds the simulated Gatekeeper with an ID.
+ *
+ * @param   id      The ID of the Gatekeeper
+ *
+ * @return  The Gatekeeper, or NULL if no Gatekeeper has the ID
+ *
+ ******************************************************************************/
+Gatekeeper *findGatekeeper(uint32 id) {
+    for (uint32_t i = 0; i < gatekeeperCount; i++) {
+        if (gatekeepers[i].id == id) {
+            return &gatekeepers[i];
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************/
+/*
+ * Delivers a message to its recipients. Broadcasts go to every BoidCPU except
+ * the sender and multicasts go to the BoidCPUs that neighbour the sender, as
+ * the others would ignore them. Other messages go to the core with the ID
+ * they are addressed to.
+ *
+ * @param   data    The message
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void deliverMessage(uint32 *data) {
+    uint32 to = data[CMD_TO];
+    uint32 from = data[CMD_FROM];
+
+    for (uint32_t i = 1; i < boidCPUCount + 1; i++) {
+        if (channels[i].id == from) continue;
+
+        if ((to == CMD_BROADCAST) || (to == channels[i].id) ||
+                ((to == CMD_MULTICAST) && isNeighbourOf(&channels[i], from))) {
+            sendToChannel(i, data);
+        }
+    }
+
+    if (to == CONTROLLER_ID) {
+        sendToChannel(MASTER_CHANNEL, data);
+    }
+}
+
+/******************************************************************************/
+/*
+ * Sends a message to the core on a channel.
+ *
+ * @param   channel The channel of the recipient core
+ * @param   data    The message
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void sendToChannel(uint8_t channel, uint32 *data) {
+    for (uint32_t i = 0; i < data[CMD_LEN]; i++) {
+        channels[channel].toCore.write(data[i]);
+    }
+}
+
+/******************************************************************************/
+/*
+ * Creates a message and sends it to the core on a channel.
+ *
+ * @param   channel The channel of the recipient core
+ * @param   len     The length of the message body
+ * @param   to      The ID of the recipient of the message
+ * @param   from    The ID of the message sender
+ * @param   type    The type of the message
+ * @param   body    The message body
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void sendToChannel(uint8_t channel, uint32 len, uint32 to, uint32 from,
+        uint32 type, uint32 *body) {
+    uint32 data[MAX_CMD_LEN];
+
+    data[CMD_LEN]  = len + CMD_HEADER_LEN;
+    data[CMD_TO]   = to;
+    data[CMD_FROM] = from;
+    data[CMD_TYPE] = type;
+
+    for (uint32_t i = 0; i < len; i++) {
+        data[CMD_HEADER_LEN + i] = body[i];
+    }
+
+    sendToChannel(channel, data);
+}
+
+/******************************************************************************/
+/*
+ * Determines whether a BoidCPU has another BoidCPU as a neighbour.
+ *
+ * @param   channel The channel of the BoidCPU
+ * @param   id      The ID of the other BoidCPU
+ *
+ * @return  True if the BoidCPU with the ID is a neighbour, false otherwise
+ *
+ ******************************************************************************/
+bool isNeighbourOf(Channel *channel, uint32 id) {
+    for (int i = 0; i < MAX_BOIDCPU_NEIGHBOURS; i++) {
+        if (channel->neighbours[i] == id) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,42 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * hostTest.h
+ *
+ * The reporting shared by the host tests. Each check is printed with its
+ * result and the failures are counted, so that a test can return non-zero if
+ * any check failed.
+ *
+ ******************************************************************************/
+
+#ifndef HOST_TEST_H_
+#define HOST_TEST_H_
+
+/******************************* Include Files ********************************/
+
+#include <stdio.h>
+
+/*************************** Variable Definitions *****************************/
+
+static int failures = 0;            // The checks that have failed
+
+/*************************** Function Definitions *****************************/
+
+/******************************************************************************/
+/*
+ * Reports the result of a check.
+ *
+ * @param   name        What was checked
+ * @param   passed      Whether the check passed
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+static inline void check(const char *name, bool passed) {
+    printf("%-48s %s\n", name, passed ? "pass" : "FAIL");
+    if (!passed) {
+        failures++;
+    }
+}
+
+#endif /* HOST_TEST_H_ */
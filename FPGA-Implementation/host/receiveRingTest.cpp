@@ -0,0 +1,149 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * receiveRingTest.cpp
+ *
+ * A host test of the ring that the Gatekeeper holds received Ethernet frames
+ * in (see receiveRing.h). Bursts of synthetic frames are delivered as the
+ * Gatekeeper's receive interrupt handler would store them: a slot is reserved,
+ * the frame is copied in and the slot is committed if the frame has the
+ * simulation's Ethernet type. Frames are then processed as checkForInput()
+ * would. The test checks that a full ring drops and counts new frames rather
+ * than overwriting frames that have not been processed, that frames of other
+ * types are not kept and that frames are processed in the order they arrived.
+ *
+ * Usage: receiveRingTest
+ *
+ ******************************************************************************/
+
+/******************************* Include Files ********************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+
+#include "../receiveRing.h"
+#include "hostTest.h"
+
+/**************************** Constant Definitions ****************************/
+
+#define EXT_INPUT_SIZE          8   // As in gatekeeper.c
+#define FRAME_SIZE              64  // Enough for the header and a sequence
+#define SEQUENCE_IDX            14  // Where a frame's sequence number is held
+
+/*************************** Variable Definitions *****************************/
+
+ReceiveRing ring = {0, 0, 0};
+u8 frames[EXT_INPUT_SIZE][FRAME_SIZE];
+
+u32 nextSequence = 0;               // The sequence number of the next arrival
+u32 expectedSequence = 0;           // The lowest sequence number to process
+int processedCount = 0;             // The frames processed
+
+/***************************** Function Definitions ***************************/
+
+/******************************************************************************/
+/*
+ * Delivers a frame as the Gatekeeper's receive interrupt handler would. The
+ * frame is given the next sequence number if it is for the simulation.
+ *
+ * @param   relevant    Whether the frame has the simulation's Ethernet type
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+void receiveFrame(bool relevant) {
+    if (!receiveRingReserve(&ring, EXT_INPUT_SIZE)) {
+        if (relevant) {
+            nextSequence++;
+        }
+        return;
+    }
+
+    u8 *frame = frames[ring.arrivalPtr];
+    memset(frame, 0, FRAME_SIZE);
+    frame[12] = relevant ? 0x55 : 0x08;
+    frame[13] = relevant ? 0xAA : 0x00;
+    if (relevant) {
+        memcpy(&frame[SEQUENCE_IDX], &nextSequence, sizeof(nextSequence));
+        nextSequence++;
+    }
+
+    if ((frame[12] == 0x55) && (frame[13] == 0xAA)) {
+        receiveRingCommit(&ring, EXT_INPUT_SIZE);
+    }
+}
+
+/******************************************************************************/
+/*
+ * Processes up to a number of waiting frames, as checkForInput() would.
+ *
+ * @param   count       The most frames to process
+ *
+ * @return              The sequence number of the last frame processed, or
+ *                      -1 if the frames were not processed in order
+ *
+ ******************************************************************************/
+long processFrames(int count) {
+    long last = 0;
+
+    for (int i = 0; (i < count) && !receiveRingEmpty(&ring); i++) {
+        u32 sequence = 0;
+        memcpy(&sequence, &frames[ring.processPtr][SEQUENCE_IDX],
+                sizeof(sequence));
+        if (sequence < expectedSequence) {
+            return -1;
+        }
+
+        expectedSequence = sequence + 1;
+        processedCount++;
+        last = sequence;
+        receiveRingRelease(&ring, EXT_INPUT_SIZE);
+    }
+
+    return last;
+}
+
+int main() {
+    // A burst into an empty ring keeps all but one slot's worth of frames
+    for (int i = 0; i < 20; i++) {
+        receiveFrame(true);
+    }
+    check("Burst of 20 drops 13 frames", ring.dropCount == 13);
+    check("Burst of 20 keeps the first 7 frames",
+            (processFrames(20) == 6) && (processedCount == 7));
+    check("Ring is empty once processed", receiveRingEmpty(&ring));
+
+    // Frames of other types never take a slot
+    expectedSequence = nextSequence;
+    receiveFrame(false);
+    receiveFrame(true);
+    receiveFrame(false);
+    check("Other frame types are not kept",
+            processFrames(20) == (long)(nextSequence - 1));
+    check("Other frame types are not counted as dropped",
+            ring.dropCount == 13);
+
+    // Processing one frame per pass while frames arrive two at a time fills 
+    // the ring on the seventh pass, then drops one frame on each later pass
+    u32 dropsBefore = ring.dropCount;
+    bool inOrder = true;
+    for (int i = 0; i < 10; i++) {
+        receiveFrame(true);
+        receiveFrame(true);
+        if (processFrames(1) < 0) {
+            inOrder = false;
+        }
+    }
+    check("Frames are processed in the order they arrive", inOrder);
+    check("Drops only once the ring has filled",
+            (ring.dropCount - dropsBefore) == 4);
+
+    check("The wrapped ring drains in order", processFrames(20) >= 0);
+    check("Ring is empty once drained", receiveRingEmpty(&ring));
+
+    return (failures == 0) ? 0 : 1;
+}
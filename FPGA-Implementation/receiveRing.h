@@ -0,0 +1,98 @@
+/**
+ * Copyright 2015 abradbury
+ *
+ * receiveRing.h
+ *
+ * The book-keeping of the ring that the Gatekeeper (gatekeeper.c) holds
+ * received Ethernet frames in until they are processed. The Ethernet receive
+ * interrupt handler reserves a slot for each frame, and commits it if the
+ * frame is for the simulation. checkForInput() processes the frames in the
+ * order they arrived and releases their slots.
+ *
+ * One slot is always left empty so that a full ring can be told apart from an
+ * empty one. If the ring is full, a new frame is dropped and counted rather
+ * than overwriting a frame that has not been processed.
+ *
+ * The number of slots is passed to each function so that, once inlined, the
+ * wrap is a constant. host/receiveRingTest.cpp tests the ring with bursts of
+ * synthetic frames.
+ *
+ ******************************************************************************/
+
+#ifndef RECEIVE_RING_H_
+#define RECEIVE_RING_H_
+
+/**************************** Type Definitions ********************************/
+
+typedef struct {
+    volatile u8 arrivalPtr;     // Next frame arrival slot
+    volatile u8 processPtr;     // Next frame to process
+    volatile u32 dropCount;     // Frames dropped as the ring was full
+} ReceiveRing;
+
+/*************************** Function Definitions *****************************/
+
+/******************************************************************************/
+/*
+ * Checks whether there are any frames waiting to be processed.
+ *
+ * @param   ring    The receive ring
+ *
+ * @return          1 if the ring is empty, 0 otherwise
+ *
+ ******************************************************************************/
+static inline int receiveRingEmpty(ReceiveRing *ring) {
+    return ring->processPtr == ring->arrivalPtr;
+}
+
+/******************************************************************************/
+/*
+ * Reserves the slot at arrivalPtr for a new frame. If the ring is full, the
+ * frame is counted as dropped and no slot is reserved.
+ *
+ * @param   ring    The receive ring
+ * @param   size    The number of slots in the ring
+ *
+ * @return          1 if the frame can be stored at arrivalPtr, 0 if it must
+ *                  be dropped
+ *
+ ******************************************************************************/
+static inline int receiveRingReserve(ReceiveRing *ring, int size) {
+    if (((ring->arrivalPtr + 1) % size) == ring->processPtr) {
+        ring->dropCount++;
+        return 0;
+    }
+
+    return 1;
+}
+
+/******************************************************************************/
+/*
+ * Commits the frame stored in the reserved slot, so that it is processed. A
+ * frame that is not committed is overwritten by the next frame to arrive.
+ *
+ * @param   ring    The receive ring
+ * @param   size    The number of slots in the ring
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+static inline void receiveRingCommit(ReceiveRing *ring, int size) {
+    ring->arrivalPtr = (ring->arrivalPtr + 1) % size;
+}
+
+/******************************************************************************/
+/*
+ * Releases the slot of the frame at processPtr once it has been processed.
+ *
+ * @param   ring    The receive ring
+ * @param   size    The number of slots in the ring
+ *
+ * @return  None
+ *
+ ******************************************************************************/
+static inline void receiveRingRelease(ReceiveRing *ring, int size) {
+    ring->processPtr = (ring->processPtr + 1) % size;
+}
+
+#endif /* RECEIVE_RING_H_ */